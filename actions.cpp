@@ -9,6 +9,10 @@
 #define ASSERT_X(x) (assert((x) >= 0 && (x) < width))
 #define ASSERT_Y(y) (assert((y) >= 0 && (y) < height))
 
+#ifndef min
+#define min(x,y) ((x)<(y)?(x):(y))
+#endif
+
 using namespace std;
 
 void GTerm::gfx_input()
@@ -68,6 +72,13 @@ void GTerm::normal_input()
 
     ASSERT_X(cursor_x);
 
+    if (bulk && !(mode_flags & (NOEOLWRAP | INSERT)) && charset[cur_charset] != '0' &&
+            current_state == normal_state &&
+            cursor_y >= scroll_top && cursor_y <= scroll_bot) {
+        bulk_input();
+        return;
+    }
+
     n = 0;
     if (mode_flags & NOEOLWRAP) {
         while (n<data_len && input_data[n]>31) n++;
@@ -83,8 +94,6 @@ void GTerm::normal_input()
 
     assert(n > 0);
 
-	translate_charset(input_data, input_data+n);
-
 #if 0
     memcpy(str, input_data, n);
     str[n] = 0;
@@ -97,7 +106,7 @@ void GTerm::normal_input()
         changed_line(cursor_y, cursor_x, cursor_x+n-1);
     }
 
-    y = linenumbers[cursor_y]*width;
+    y = linenumbers[row(cursor_y)]*width;
     if (mode_flags & INSERT)
         for (i=width-1; i>=cursor_x+n; i--) {
             text[y+i] = text[y+i-n];
@@ -106,8 +115,13 @@ void GTerm::normal_input()
 
     c = calc_color(fg_color, bg_color, mode_flags);
 
+    // Translate in the cell buffer so the input, which may be the
+    // console's ring buffer, is never written to
+    memcpy(text+y+cursor_x, input_data, n);
+    // without wrapping, the rest of the span overwrites the last column
+    if (n_taken > n) text[y+cursor_x+n-1] = input_data[n_taken-1];
+    translate_charset(text+y+cursor_x, text+y+cursor_x+n);
     for (i=0; i<n; i++) {
-        text[y+cursor_x] = input_data[i];
         color[y+cursor_x] = c;
         cursor_x++;
     }
@@ -127,6 +141,127 @@ void GTerm::normal_input()
     data_len -= n_taken-1;
 }
 
+// Fast path for normal_input in auto-wrap mode with a charset that needs no
+// translation.  Takes printable text along with CR and LF, which can't
+// change state here, up to the next other control character.  A first pass
+// counts the line advances so the region is scrolled once up front; text
+// landing on rows that would scroll out before the next update is dropped.
+// As in lf(), an LF that scrolls keeps a pending wrap unless newline mode
+// moves the cursor.
+void GTerm::bulk_input()
+{
+    unsigned char *p = input_data, *end = input_data + data_len;
+    int x, y, n, c, adv, mx, bot;
+    bool wrap;
+
+    // find the end of the span, following the same wrap rules as below
+    x = cursor_x;
+    wrap = force_wrap;
+    adv = 0;
+    while (p < end) {
+        if (*p == 015) {
+            x = 0;
+            wrap = false;
+            p++;
+        } else if (*p == 012) {
+            if (adv < scroll_bot-cursor_y || (mode_flags & NEWLINE)) wrap = false;
+            adv++;
+            if (mode_flags & NEWLINE) x = 0;
+            p++;
+        } else if (*p < 32) {
+            break;
+        } else {
+            for (n=0; p+n < end && p[n] > 31; n++);
+            p += n;
+            if (wrap) {
+                adv++;
+                x = 0;
+                wrap = false;
+            }
+            if (x+n < width) {
+                x += n;
+            } else {
+                // fill this line, then whole lines, then a partial one
+                n -= width-x;
+                adv += (n+width-1) / width;
+                x = n ? (n-1) % width + 1 : width;
+                if (x == width) {
+                    x = width-1;
+                    wrap = true;
+                }
+            }
+        }
+    }
+    end = p;
+    p = input_data;
+
+    changed_line(cursor_y, cursor_x, cursor_x);
+    y = cursor_y;
+    bot = scroll_bot;   // where y would be at the bottom of the region
+    adv -= scroll_bot-cursor_y;
+    if (adv > 0) {
+        mx = scroll_bot-scroll_top+1;
+        if (adv < mx) {
+            scroll_region(scroll_top, scroll_bot, adv);
+        } else {
+            clear_area(0, scroll_top, width-1, scroll_bot);
+            scroll_stats.lines_scrolled += adv;
+        }
+        y -= adv;
+        bot -= adv;
+        if (y < scroll_top) scroll_stats.lines_dropped += scroll_top-y;
+    }
+
+    c = calc_color(fg_color, bg_color, mode_flags);
+    x = cursor_x;
+    wrap = force_wrap;
+    while (p < end) {
+        if (*p == 015) {
+            x = 0;
+            wrap = false;
+            p++;
+            continue;
+        }
+        if (*p == 012) {
+            if (y < bot || (mode_flags & NEWLINE)) wrap = false;
+            y++;
+            if (mode_flags & NEWLINE) x = 0;
+            p++;
+            continue;
+        }
+        if (wrap) {
+            y++;
+            x = 0;
+            wrap = false;
+        }
+
+        for (n=0; p+n < end && p[n] > 31 && x+n < width; n++);
+
+        if (y >= scroll_top) {
+            int yp = linenumbers[row(y)]*width + x;
+            memcpy(text+yp, p, n);
+            for (int i=0; i<n; i++) color[yp+i] = c;
+            changed_line(y, x, x+n-1);
+        }
+
+        x += n;
+        p += n;
+        if (x >= width) {
+            x = width-1;
+            wrap = true;
+        }
+    }
+
+    ASSERT_Y(y);
+    cursor_x = x;
+    cursor_y = y;
+    force_wrap = wrap;
+
+    // ProcessInput steps past the last byte taken
+    data_len -= end-input_data-1;
+    input_data = end-1;
+}
+
 void GTerm::cr()
 {
 	move_cursor(0, cursor_y);
@@ -242,9 +377,14 @@ void GTerm::reset()
 {
 	int i;
 
+	// hard reset goes back to the normal screen
+	switch_screen(false);
+
 	pending_scroll = 0;
+	scroll_rot     = 0;
     force_wrap     = false;
     inverse_mode   = false;
+    sync_update    = false;
 	cursor_x       = 0;
 	cursor_y       = 0;
 	save_x         = 0;
@@ -299,7 +439,7 @@ void GTerm::param_digit()
 
 void GTerm::next_param()
 {
-	nparam++;
+	if (nparam < (int)(sizeof(param)/sizeof(param[0]))-1) nparam++;
 }
 
 void GTerm::cursor_left()
@@ -339,10 +479,12 @@ void GTerm::cursor_position()
 	int x, y;
 	x = param[1];	if (x<1) x=1;
 	y = param[0];	if (y<1) y=1;
+	// positions past the edge, which programs do send, stop at it
+	x = min(x, width);
 	if (mode_flags & CURSORRELATIVE) {
-		move_cursor(x-1, y-1+scroll_top);
+		move_cursor(x-1, min(y-1+scroll_top, scroll_bot));
 	} else {
-		move_cursor(x-1, y-1);
+		move_cursor(x-1, min(y, height)-1);
 	}
 }
 
@@ -383,6 +525,23 @@ void GTerm::set_mode()
                     clear_mode_flag(CURSORINVISIBLE);
                     move_cursor(cursor_x, cursor_y);
                     break;
+        case 3026:	// synchronized output: begin frame
+                    sync_update = true;
+                    sync_frames = 0;
+                    break;
+        case 1047:
+        case 2047:	switch_screen(true);	break;
+        case 2049:	{
+                        // save cursor and switch to a cleared alternate screen
+                        alt_save_x = cursor_x;
+                        alt_save_y = cursor_y;
+                        alt_save_mode = mode_flags;
+                        alt_save_fg = fg_color;
+                        alt_save_bg = bg_color;
+                        switch_screen(true);
+                        clear_area(0, 0, width-1, height-1);
+                    }
+                    break;
         case 4:		set_mode_flag(INSERT);		break;
         case 12:	clear_mode_flag(LOCALECHO);	break;
         case 20:	set_mode_flag(NEWLINE);		break;
@@ -409,6 +568,26 @@ void GTerm::clear_mode()
                     set_mode_flag(CURSORINVISIBLE);	break;
                     move_cursor(cursor_x, cursor_y);
                     break;
+        case 3026:	// synchronized output: end frame
+                    sync_update = false;
+                    break;
+        case 1047:	switch_screen(false);	break;
+        case 2047:	{
+                        if (alt_screen) clear_area(0, 0, width-1, height-1);
+                        switch_screen(false);
+                    }
+                    break;
+        case 2049:	{
+                        if (!alt_screen) break;
+                        switch_screen(false);
+                        // only what DECSC would have saved comes back
+                        fg_color = alt_save_fg;
+                        bg_color = alt_save_bg;
+                        mode_flags = (mode_flags & ~15) | (alt_save_mode & 15);
+                        ModeChange(mode_flags);
+                        move_cursor(min(alt_save_x, width-1), min(alt_save_y, height-1));
+                    }
+                    break;
         case 4:		clear_mode_flag(INSERT);	break;
         case 12:	set_mode_flag(LOCALECHO);	break;
         case 20:	clear_mode_flag(NEWLINE);	break;
@@ -433,7 +612,15 @@ void GTerm::set_margins()
 
     /* Minimum allowed region is 2 lines */
     if (t < b && b <= height) {
+        flush_scroll();
         if (pending_scroll) update_changes();
+        if (pending_scroll) {
+            // Can't blit with the old margins while updates are held,
+            // so repaint the region from the cell buffer instead
+            for (int y = scroll_top; y <= scroll_bot; y++)
+                changed_line(y, 0, width-1);
+            pending_scroll = 0;
+        }
 
         scroll_top = t-1;
         scroll_bot = b-1;
@@ -527,7 +714,7 @@ void GTerm::insert_line()
   
 void GTerm::set_colors()
 {
-    int n;
+    int n, c;
 
     if (!nparam && param[0] == 0) {
         clear_mode_flag(0x0f);
@@ -541,6 +728,10 @@ void GTerm::set_colors()
             bg_color = param[n]%10;
         } else if (param[n] >= 30 && param[n] <= 37) {
             fg_color = param[n]%10;
+        } else if (param[n] >= 100 && param[n] <= 107) {
+            bg_color = param[n]%10 + 8;
+        } else if (param[n] >= 90 && param[n] <= 97) {
+            fg_color = param[n]%10 + 8;
         } else switch (param[n]) {
             case 0:
                 clear_mode_flag(0x0f);
@@ -598,6 +789,10 @@ void GTerm::set_colors()
                 clear_mode_flag(INVERSE);
                 break;
             case 38:
+                if ((c = extended_color(n, &fg_color)) > 0) {
+                    n += c;
+                    break;
+                }
                 /* ANSI X3.64-1979 (SCO-ish?)
                  * Enables underscore, white foreground
                  * with white underscore (Linux - use
@@ -615,12 +810,36 @@ void GTerm::set_colors()
                 fg_color = 7;
                 clear_mode_flag(UNDERLINE);
                 break;
+            case 48:
+                if ((c = extended_color(n, &bg_color)) > 0) n += c;
+                break;
             case 49:
                 bg_color = 0;
                 break;
         }
     }
 }
+
+/*
+ * Parse the xterm extended color forms following a 38 or 48 parameter:
+ *   5;n      256-color palette index
+ *   2;r;g;b  truecolor, quantized to the palette
+ * Returns the number of extra parameters consumed, or 0 if this wasn't
+ * an extended color.
+ */
+int GTerm::extended_color(int n, int *color)
+{
+    if (n+2 <= nparam && param[n+1] == 5) {
+        *color = min(param[n+2], 255);
+        return 2;
+    }
+    if (n+4 <= nparam && param[n+1] == 2) {
+        *color = rgb_to_index(min(param[n+2], 255), min(param[n+3], 255),
+                min(param[n+4], 255));
+        return 4;
+    }
+    return 0;
+}
   
 void GTerm::clear_tab()
 {
@@ -649,7 +868,7 @@ void GTerm::screen_align()
 
     c = calc_color(7, 0, 0);
     for (y=0; y<height; y++) {
-        yp = linenumbers[y]*width;
+        yp = linenumbers[row(y)]*width;
         changed_line(y, 0, width-1);
         for (x=0; x<width; x++) {
             text[yp+x] = 'E';
@@ -731,6 +950,7 @@ void GTerm::cset_g1_2()
 void GTerm::cursor_ypos() {
     int  y;
     y = param[0];	if (y < 1) y=1;
+    y = min(y, height);
     //	if (mode_flags & CURSORRELATIVE) {
     //		move_cursor(x-1, y-1+scroll_top);
     //	} else {
@@ -1,52 +1,172 @@
 #include "console.hpp"
+#include "instrument.hpp"
+#include <unistd.h>
 
-void VGAConsole::console_task()
+INSTR_DEFINE_SECTION(process);
+INSTR_DEFINE_SECTION(update);
+INSTR_DEFINE_SECTION(draw);
+
+// Fold a new sample into a running average, weighting it 1/8
+static inline void average_in(uint32_t& avg, uint32_t sample)
+{
+    avg = avg - (avg >> 3) + (sample >> 3);
+}
+
+void VGAConsole::add_chars(const uint8_t *p, int len)
+{
+    term_lock.enter();
+    if (parsing) {
+        // Called back from inside ProcessInput on this core; the emulator
+        // isn't reentrant, so leave it for the loop below
+        input.write(p, len);
+        term_lock.exit();
+        return;
+    }
+    parsing = true;
+    
+    // ProcessInput doesn't modify its input
+    uint32_t start = time_us_32();
+    {
+        INSTR_SECTION(process);
+        term->ProcessInput(len, (unsigned char *)p);
+    }
+    // Small writes are mostly overhead, so don't learn from them
+    if (len >= 64) {
+        average_in(parse_ns_per_byte, (time_us_32() - start) * 1000 / len);
+    }
+    bytes_parsed += len;
+    INSTR_TRACE(EV_INPUT, len);
+    
+    uint8_t *q;
+    int count;
+    while ((count = input.peek(&q)) > 0) {
+        term->ProcessInput(count, q);
+        input.consume(count);
+    }
+    
+    parsing = false;
+    publish();
+    std::string replies;
+    replies.swap(term->replies);
+    term_lock.exit();
+    
+    if (!replies.empty()) write(1, replies.data(), replies.size());
+}
+
+// Queue the emulator's changes for drawing, at most once per video frame.
+// Called with term_lock held.
+void VGAConsole::publish()
 {
-    //uint64_t timeout = time_us_64() + 16666;
-    bool do_terminal = false;
-            
-    in_vblank_now = term->graphics->video->in_vblank();
-    if (!was_in_vblank && in_vblank_now) do_terminal = true;
-    was_in_vblank = in_vblank_now;    
-    if (!do_terminal && buf_head == buf_tail) return;
-    
-    int tc = 0;
-    if (buf_head != buf_tail) {
-        // If we have characters from the serial bus, send them in bulk 
-        // to the terminal emulator
-        int tail = buf_tail;
-        int head = buf_head;
-        if (tail > head) {
-            int count = tail - head;
-            tc = count;
-            // XXX Calls to ProcessInput might draw text; must hide mouse
-            term->ProcessInput(count, text_buffer + head);
-            buf_head = tail;
-        } else {
-            int count = 4096 - head;
-            tc = count;
-            term->ProcessInput(count, text_buffer + head);
-            count = tail;
-            tc += count;
-            term->ProcessInput(count, text_buffer);
-            buf_head = tail;
+    uint32_t frame = term->graphics->video->frame;
+    if (frame == publish_frame) return;
+    if (!term->DirtyCells()) return;
+    publish_frame = frame;
+    bool render = should_render();
+    bytes_parsed = 0;
+    if (!render) return;
+    
+    INSTR_TRACE(EV_RENDER, frame);
+    INSTR_SECTION(update);
+    term->queue_open = true;
+    term->Update();
+    term->queue_open = false;
+    doorbell.ring();
+}
+
+bool VGAConsole::should_render()
+{
+    // An update queues a command per dirty row, a scroll and the cursor
+    int rows;
+    int cells = term->DirtyCells(&rows);
+    int need = rows + 2;
+    uint32_t queued = term->cells_queued - term->cells_drawn;
+    uint64_t parse_ns = (uint64_t)bytes_parsed * parse_ns_per_byte;
+    if (draw_queue.space() < need) {
+        decisions.full++;
+        frames_skipped++;
+        INSTR_TRACE(EV_RENDER_SKIP, draw_queue.size());
+        return false;
+    } else if (frames_skipped + 1 >= MAX_SKIP_FRAMES) {
+        decisions.forced++;
+    } else if (parse_ns > FRAME_US * 500) {
+        // Updating takes the writer's time; leave it to parse
+        decisions.busy++;
+        frames_skipped++;
+        INSTR_TRACE(EV_RENDER_SKIP, bytes_parsed);
+        return false;
+    } else if (draw_queue.empty()) {
+        decisions.idle++;
+    } else {
+        uint32_t cost_ns = (queued + cells) * render_ns_per_cell;
+        if (cost_ns > FRAME_US * 1000) {
+            decisions.skipped++;
+            frames_skipped++;
+            INSTR_TRACE(EV_RENDER_SKIP, queued);
+            return false;
         }
-        terminal_pending = true;
-    }
-    
-    // We only need to update the display once every video frame, so we
-    // wait until 1/60 sec has elapsed and tell the emulator to perform
-    // all pending display updates. The update is skipped if the 
-    // terminal is falling behind.
-    if (do_terminal && tc < 2048) {
-        if (do_terminal) {
-            mouse->hide_mouse();
-            term->Update();
-            mouse->draw_mouse();
-        } else {
-            mouse->draw_mouse();
+        decisions.fits++;
+    }
+    frames_skipped = 0;
+    return true;
+}
+
+void VGAConsole::render_task()
+{
+    // Commands are drawn as soon as the beam is clear of the rows they
+    // touch, so the work spreads over the whole frame. A command the beam
+    // is on stops the queue, since later ones may draw over it, until a
+    // later pass.
+    uint32_t frame = term->graphics->video->frame;
+    if (frame != render_frame) {
+        if (render_us) frame_render.add(render_us);
+        if (!draw_queue.empty()) frames_incomplete++;
+        render_frame = frame;
+        render_us = 0;
+        
+        // Changes made after the writer's last publish would otherwise
+        // wait for its next write. If a writer is busy it will publish
+        // them itself.
+        if (term_lock.try_enter()) {
+            publish();
+            term_lock.exit();
         }
-        terminal_pending = false;
-        // timeout = time_us_64() + 16666;
     }
-}
\ No newline at end of file
+    if (!work_queued()) return;
+    
+    INSTR_SECTION(draw);
+    uint32_t cells = term->cells_drawn;
+    uint32_t start = time_us_32();
+    mouse->hide_mouse();
+    DrawCmd *cmd;
+    int count;
+    while ((count = draw_queue.peek(&cmd)) > 0) {
+        int done;
+        for (done=0; done<count && term->can_execute(cmd[done]); done++) {
+            term->execute(cmd[done]);
+        }
+        draw_queue.consume(done);
+        if (done < count) {
+            rows_deferred++;
+            break;
+        }
+    }
+    
+    // Program drawing isn't kept clear of the beam. Only what was queued
+    // when this started is done, so a busy program can't hold up the pass.
+    if (gfx) {
+        GfxCmd *g;
+        int left = gfx->size();
+        while (left > 0 && (count = gfx->peek(&g)) > 0) {
+            if (count > left) count = left;
+            for (int i=0; i<count; i++) term->graphics->execute(g[i]);
+            gfx->consume(count);
+            left -= count;
+        }
+    }
+    mouse->draw_mouse();
+    uint32_t dt = time_us_32() - start;
+    render_us += dt;
+    
+    cells = term->cells_drawn - cells;
+    if (cells >= 80) average_in(render_ns_per_cell, dt * 1000 / cells);
+}
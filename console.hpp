@@ -3,10 +3,15 @@
 
 #include "vgaterm.hpp"
 #include "mouse.hpp"
-#include <vector>
-
-typedef void (*task_f)();
+#include "spsc_ring.hpp"
+#include "doorbell.hpp"
+#include "core_lock.hpp"
+#include "histogram.hpp"
 
+// The console is split in two stages. Text is parsed by whichever core
+// writes it, so the Lisp side's output is parsed on core 0, and once a
+// frame the emulator's changes go into draw_queue as commands carrying
+// copies of the cells. Core 1 only draws, taking commands off the queue.
 struct VGAConsole : public KeyReceiver {
     VGATerm *term;
     VGAMouse *mouse;
@@ -14,28 +19,85 @@ struct VGAConsole : public KeyReceiver {
     VGAConsole(VGATerm *t, VGAMouse *m) {
         term = t;
         mouse = m;
+        term->queue = &draw_queue;
+        term->hold_replies = true;
     }
     
-    // std::vector<task_f> tasks;
-    // void add_task(task_f t) { tasks.push_back(t); }
+    // Parsing side. term_lock keeps the two cores out of the emulator at
+    // the same time; parsing is set while the holder is inside it.
+    CoreLock term_lock;
+    bool parsing = false;
+    
+    // Text written while parsing, from inside ProcessInput on the same
+    // core, goes here and is parsed as soon as the current write is done.
+    // Replies the emulator sends back are written after term_lock is let
+    // go, since writing takes the stdio lock, which another core can hold
+    // while it waits for term_lock.
+    typedef SPSCRing<uint8_t, 4096> InputRing;
+    InputRing input;
     
-    // Ring buffer for characters from serial input
-    volatile int buf_head = 0;
-    volatile int buf_tail = 0;
-    uint8_t text_buffer[4096];
+    void add_char(uint8_t c) { add_chars(&c, 1); }
+    void add_chars(const uint8_t *p, int len);
+    void publish();
     
-    // Insert character into ring buffer
-    void add_char(uint8_t c) {
-        int next_tail = (buf_tail + 1) & 4095;
-        while (next_tail == buf_head);
-        text_buffer[buf_tail] = c;
-        buf_tail = next_tail;
+    // Drawing side, run by the core 1 scheduler. Rung when commands are
+    // queued so the drawing core can sleep when idle.
+    DrawQueue draw_queue;
+    Doorbell doorbell;
+    uint32_t idle_waits = 0;
+    void render_task();
+    
+    // Drawing queued by programs, see lisp_gfx.cpp, done after the text
+    GfxQueue *gfx = 0;
+    void set_gfx(GfxQueue *q) {
+        gfx = q;
+        q->doorbell = &doorbell;
     }
+    bool work_queued() { return !draw_queue.empty() || (gfx && !gfx->empty()); }
+    
+    // Sleep until a producer rings, the next frame starts or an interrupt
+    // on this core arrives, unless there is drawing left to do. The frame
+    // ring is what lets changes a skipped frame left unpublished, and
+    // timed tasks, go on without new output to wake for.
+    void wait_for_work() {
+        if (work_queued()) return;
+        idle_waits++;
+        doorbell.wait();
+    }
+    
+    // Frame skipping. Once per frame publish() decides whether to queue
+    // the emulator's changes. A frame is skipped if the queue doesn't have
+    // room for a whole update, if the writer spent more than half the last
+    // frame parsing, so output is arriving faster than it can be shown, or
+    // if drawing what is still queued plus the dirty cells won't fit in
+    // one frame; rows that scroll away meanwhile are never drawn. The
+    // display is still drawn at least every MAX_SKIP_FRAMES when there's
+    // room.
+    static constexpr int MAX_SKIP_FRAMES = 4;
+    static constexpr uint32_t FRAME_US = 16683;
+    uint32_t parse_ns_per_byte = 200;   // running averages
+    uint32_t render_ns_per_cell = 500;
+    uint32_t bytes_parsed = 0;          // since the last publish
+    int frames_skipped = 0;             // in a row, right now
+    uint32_t publish_frame = 0;
+    bool should_render();
+    
+    // Counters for each decision should_render makes
+    struct RenderDecisions {
+        uint32_t idle;      // rendered, nothing left to draw
+        uint32_t fits;      // rendered, queued and new drawing fit in a frame
+        uint32_t forced;    // rendered, too many frames skipped
+        uint32_t skipped;
+        uint32_t full;      // skipped, no room in the queue
+        uint32_t busy;      // skipped, the writer is flooding
+    } decisions = {0, 0, 0, 0, 0, 0};
     
-    bool terminal_pending = false;
-    bool was_in_vblank = false;
-    bool in_vblank_now = false;
-    void console_task();
+    // Render state and statistics
+    uint32_t render_frame = 0;
+    uint32_t render_us = 0;         // spent drawing in the current frame
+    Histogram frame_render;         // microseconds of drawing per frame
+    uint32_t rows_deferred = 0;     // commands put off because of the beam
+    uint32_t frames_incomplete = 0; // frames that ended with commands queued
     
     virtual void report_key_pressed(int ch) {
         add_char(ch);
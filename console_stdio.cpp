@@ -11,9 +11,7 @@ void vga_out_chars(const char *buf, int len)
 {
     if (!console) return;
     
-    for (int i=0; i<len; i++) {
-        console->add_char(buf[i]);
-    }
+    console->add_chars((const uint8_t *)buf, len);
 }
 
 int vga_in_chars(char *buf, int len)
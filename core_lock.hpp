@@ -0,0 +1,38 @@
+#ifndef INCLUDED_CORE_LOCK_HPP
+#define INCLUDED_CORE_LOCK_HPP
+
+// Recursive lock that either core can hold. A core that already holds it
+// can enter again, which lets code under the lock call back into itself
+// and detect that it has done so.
+//
+// Host builds of the SDK run the cores as threads, so the same thing is
+// done with a std::recursive_mutex.
+
+#if PICO_ON_DEVICE
+
+#include "pico/mutex.h"
+
+struct CoreLock {
+    recursive_mutex_t m;
+
+    CoreLock() { recursive_mutex_init(&m); }
+    void enter() { recursive_mutex_enter_blocking(&m); }
+    bool try_enter() { return recursive_mutex_try_enter(&m, 0); }
+    void exit() { recursive_mutex_exit(&m); }
+};
+
+#else
+
+#include <mutex>
+
+struct CoreLock {
+    std::recursive_mutex m;
+
+    void enter() { m.lock(); }
+    bool try_enter() { return m.try_lock(); }
+    void exit() { m.unlock(); }
+};
+
+#endif
+
+#endif
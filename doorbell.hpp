@@ -0,0 +1,48 @@
+#ifndef INCLUDED_DOORBELL_HPP
+#define INCLUDED_DOORBELL_HPP
+
+// Wakes a core that has gone idle waiting for work from the other core.
+// On the RP2040 the producer sends an event with SEV and the consumer sleeps
+// in WFE. The event latches, so a ring between the consumer's last check for
+// work and its WFE isn't lost. An interrupt taken on the sleeping core, such
+// as USB, also wakes it, but the scanline IRQ runs on the other core, so
+// VGAVideo rings once a frame to keep polled tasks and per-frame work going.
+//
+// Host builds of the SDK have no events, so the same logic runs on a
+// condition variable, with a timeout standing in for the frame ring.
+
+#if PICO_ON_DEVICE
+
+#include "hardware/sync.h"
+
+struct Doorbell {
+    void ring() { __sev(); }
+    void wait() { __wfe(); }
+};
+
+#else
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+struct Doorbell {
+    std::mutex m;
+    std::condition_variable cv;
+    bool rung = false;
+
+    void ring() {
+        std::lock_guard<std::mutex> lock(m);
+        rung = true;
+        cv.notify_one();
+    }
+    void wait() {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait_for(lock, std::chrono::microseconds(32), [this] { return rung; });
+        rung = false;
+    }
+};
+
+#endif
+
+#endif
@@ -2,6 +2,7 @@
 #include "graphics.hpp"
 #include "myfont_rotated.h"
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <algorithm>
 
@@ -51,8 +52,8 @@ void VGAGraphics::draw_char(uint8_t ch, uint8_t co, int x, int y)
 {
     y <<= 4;
     uint8_t *pc = &customfont[(uint32_t)ch<<4];
-    uint32_t fg = (co & 15) * 0x11111111;
-    uint32_t bg = (co >> 4) * 0x11111111;
+    uint32_t fg = (co & 15) * 0x11111111u;
+    uint32_t bg = (co >> 4) * 0x11111111u;
     for (int j=0; j<16; j++) {
         uint32_t *row = (uint32_t*)video->get_row(y+j);
         row += x;
@@ -70,8 +71,8 @@ void VGAGraphics::draw_string(int x, int y, uint8_t co, uint8_t *str, int len)
     y <<= 4; // Text rows are 16 scanlines
     
     // Extract foreground and background colors and replicate them across 32-bit word
-    uint32_t fg = (co & 15) * 0x11111111;
-    uint32_t bg = (co >> 4) * 0x11111111;
+    uint32_t fg = (co & 15) * 0x11111111u;
+    uint32_t bg = (co >> 4) * 0x11111111u;
     
     // Find each string character in the display font
     uint8_t *pc[len];
@@ -160,7 +161,7 @@ int VGAGraphics::read_pixel(int x, int y)
 void VGAGraphics::clear_area(int x, int y, uint8_t color, int w)
 {
     y <<= 4;
-    uint32_t co = color * 0x11111111;
+    uint32_t co = color * 0x11111111u;
     for (int j=0; j<16; j++) {
         uint32_t *row = (uint32_t*)video->get_row(y+j);
         //memset(row+x, co, w<<2);
@@ -171,12 +172,26 @@ void VGAGraphics::clear_area(int x, int y, uint8_t color, int w)
 // Draw a 1-pixel tall horizontal line
 void VGAGraphics::draw_line(int x, int y, uint8_t color, int w)
 {
-    uint32_t co = color * 0x11111111;
+    uint32_t co = color * 0x11111111u;
     uint32_t *row = (uint32_t*)video->get_row((y<<4) + 15);
     //memset(row + x, co, w<<2);
     set_words(row+x, co, w);
 }
 
+// FNV-1a hash of the visible pixels in scan order, for checking rendered
+// output against a known-good frame
+uint32_t VGAGraphics::frame_hash()
+{
+    uint32_t h = 2166136261u;
+    for (int y=0; y<480; y++) {
+        uint8_t *row = video->get_row(y);
+        for (int x=0; x<320; x++) {
+            h = (h ^ row[x]) * 16777619u;
+        }
+    }
+    return h;
+}
+
 // Perform bitblt operation for text scrolling
 void VGAGraphics::copy_area(int sx, int sy, int dx, int dy, int w, int h)
 {
@@ -232,3 +247,179 @@ void VGAGraphics::copy_area(int sx, int sy, int dx, int dy, int w, int h)
         }
     }
 }
+
+
+// Pixel drawing for programs. Everything is clipped to the screen.
+
+void VGAGraphics::execute(const GfxCmd& cmd)
+{
+    switch (cmd.op) {
+    case GfxCmd::PLOT:
+        plot_pixel(cmd.x, cmd.y, cmd.color);
+        break;
+    case GfxCmd::LINE:
+        plot_line(cmd.x, cmd.y, cmd.w, cmd.h, cmd.color);
+        break;
+    case GfxCmd::RECT:
+        draw_rect(cmd.x, cmd.y, cmd.w, cmd.h, cmd.color);
+        break;
+    case GfxCmd::FILL:
+        fill_rect(cmd.x, cmd.y, cmd.w, cmd.h, cmd.color);
+        break;
+    case GfxCmd::CIRCLE:
+        draw_circle(cmd.x, cmd.y, cmd.w, cmd.color);
+        break;
+    case GfxCmd::BLIT:
+        blit_area(cmd.sx, cmd.sy, cmd.x, cmd.y, cmd.w, cmd.h);
+        break;
+    case GfxCmd::TEXT:
+        draw_text(cmd.x, cmd.y, cmd.color, cmd.text, cmd.len);
+        break;
+    case GfxCmd::CLEAR:
+        clear_screen(cmd.color);
+        break;
+    }
+}
+
+// Whole bytes in the middle of each row are set at once, odd pixels at
+// the ends one at a time
+void VGAGraphics::fill_rect(int x, int y, int w, int h, uint8_t color)
+{
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > WIDTH) w = WIDTH - x;
+    if (y + h > HEIGHT) h = HEIGHT - y;
+    if (w <= 0 || h <= 0) return;
+    
+    color &= 15;
+    for (int j=y; j<y+h; j++) {
+        int a = x, b = x + w;
+        if (a & 1) plot_pixel(a++, j, color);
+        if (b & 1) plot_pixel(--b, j, color);
+        if (b > a) memset(video->get_row(j) + (a>>1), color * 0x11, (b - a) >> 1);
+    }
+}
+
+void VGAGraphics::draw_rect(int x, int y, int w, int h, uint8_t color)
+{
+    if (w <= 0 || h <= 0) return;
+    fill_rect(x, y, w, 1, color);
+    fill_rect(x, y+h-1, w, 1, color);
+    fill_rect(x, y+1, 1, h-2, color);
+    fill_rect(x+w-1, y+1, 1, h-2, color);
+}
+
+// Bresenham
+void VGAGraphics::plot_line(int x0, int y0, int x1, int y1, uint8_t color)
+{
+    if (y0 == y1) {
+        fill_rect(std::min(x0, x1), y0, abs(x1 - x0) + 1, 1, color);
+        return;
+    }
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    for (;;) {
+        plot_pixel(x0, y0, color);
+        if (x0 == x1 && y0 == y1) break;
+        int e2 = 2 * err;
+        if (e2 >= dy) { err += dy; x0 += sx; }
+        if (e2 <= dx) { err += dx; y0 += sy; }
+    }
+}
+
+// Midpoint circle, plotting all eight octants at once
+void VGAGraphics::draw_circle(int cx, int cy, int r, uint8_t color)
+{
+    if (r < 0) return;
+    int x = r, y = 0, err = 1 - r;
+    while (x >= y) {
+        plot_pixel(cx + x, cy + y, color);
+        plot_pixel(cx - x, cy + y, color);
+        plot_pixel(cx + x, cy - y, color);
+        plot_pixel(cx - x, cy - y, color);
+        plot_pixel(cx + y, cy + x, color);
+        plot_pixel(cx - y, cy + x, color);
+        plot_pixel(cx + y, cy - x, color);
+        plot_pixel(cx - y, cy - x, color);
+        y++;
+        if (err < 0) {
+            err += 2 * y + 1;
+        } else {
+            x--;
+            err += 2 * (y - x) + 1;
+        }
+    }
+}
+
+// Copy a block of pixels, which may overlap where it goes. Rows are
+// copied in the order that doesn't read a row already written. When both
+// sides start on the same half of a byte the middle of each row is moved
+// as bytes, otherwise it goes a pixel at a time, in the same sort of order.
+void VGAGraphics::blit_area(int sx, int sy, int dx, int dy, int w, int h)
+{
+    // Clip against both the source and the destination
+    if (sx < 0) { w += sx; dx -= sx; sx = 0; }
+    if (sy < 0) { h += sy; dy -= sy; sy = 0; }
+    if (dx < 0) { w += dx; sx -= dx; dx = 0; }
+    if (dy < 0) { h += dy; sy -= dy; dy = 0; }
+    w = std::min(w, WIDTH - std::max(sx, dx));
+    h = std::min(h, HEIGHT - std::max(sy, dy));
+    if (w <= 0 || h <= 0) return;
+    
+    bool bytes = ((sx ^ dx) & 1) == 0;
+    for (int i=0; i<h; i++) {
+        int j = (dy > sy) ? h - 1 - i : i;
+        uint8_t *sp = video->get_row(sy + j);
+        uint8_t *dp = video->get_row(dy + j);
+        if (bytes) {
+            int a = 0, b = w;
+            int first = (sx & 1) ? read_pixel(sx, sy + j) : -1;
+            if (first >= 0) a++;
+            int last = ((sx + b) & 1) ? read_pixel(sx + b - 1, sy + j) : -1;
+            if (last >= 0) b--;
+            if (b > a) memmove(dp + ((dx + a) >> 1), sp + ((sx + a) >> 1), (b - a) >> 1);
+            if (first >= 0) plot_pixel(dx, dy + j, first);
+            if (last >= 0) plot_pixel(dx + w - 1, dy + j, last);
+        } else {
+            for (int n=0; n<w; n++) {
+                int k = (dx > sx) ? w - 1 - n : n;
+                plot_pixel(dx + k, dy + j, read_pixel(sx + k, sy + j));
+            }
+        }
+    }
+}
+
+// Text at any pixel position, drawn over what's there. A glyph that's on
+// screen at an even x is merged in a byte at a time.
+void VGAGraphics::draw_text(int x, int y, uint8_t color, const char *str, int len)
+{
+    color &= 15;
+    uint32_t fg = color * 0x11111111u;
+    for (int i=0; i<len; i++, x += FONT_WIDTH) {
+        const uint8_t *pc = &customfont[(uint32_t)(uint8_t)str[i]<<4];
+        bool fast = !(x & 1) && x >= 0 && x + FONT_WIDTH <= WIDTH && y >= 0 && y + FONT_HEIGHT <= HEIGHT;
+        for (int j=0; j<FONT_HEIGHT; j++) {
+            uint8_t p = pc[j];
+            if (!p) continue;
+            if (fast) {
+                uint8_t *row = video->get_row(y+j) + (x>>1);
+                uint32_t m = pattern_mask[p];
+                for (int k=0; k<4; k++, m >>= 8) {
+                    uint8_t mk = m;
+                    row[k] = (row[k] & ~mk) | (fg & mk);
+                }
+            } else {
+                // Bit 7 is the leftmost pixel, as in pattern_mask
+                for (int k=0; k<FONT_WIDTH; k++) {
+                    if ((p >> (7-k)) & 1) plot_pixel(x + k, y + j, color);
+                }
+            }
+        }
+    }
+}
+
+void VGAGraphics::clear_screen(uint8_t color)
+{
+    fill_rect(0, 0, WIDTH, HEIGHT, color);
+}
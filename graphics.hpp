@@ -2,8 +2,43 @@
 #define INCLUDED_GRAPHICS_HPP
 
 #include "video.hpp"
+#include "spsc_ring.hpp"
+#include "doorbell.hpp"
+
+// A drawing operation queued by a program on the other core and carried
+// out by VGAGraphics::execute. Coordinates are pixels, clipped to the
+// screen; colors are 0-15.
+struct GfxCmd {
+    enum { PLOT, LINE, RECT, FILL, CIRCLE, BLIT, TEXT, CLEAR };
+    static constexpr int TEXT_MAX = 36;
+    
+    uint8_t op;
+    uint8_t color;
+    uint8_t len;            // TEXT: bytes used in text
+    short x, y;
+    short w, h;             // RECT, FILL, BLIT; LINE: the other end; CIRCLE: radius in w
+    short sx, sy;           // BLIT: where the pixels come from
+    char text[TEXT_MAX];
+};
+
+// The producer rings doorbell, once the drawing side has set it, after
+// queueing so an idle drawing core wakes, and can watch frame to keep in
+// step with the display.
+struct GfxQueue : public SPSCRing<GfxCmd, 64> {
+    Doorbell *doorbell = 0;
+    const volatile uint32_t *frame = 0;
+};
 
 struct VGAGraphics {
+    // Text cells are one 8x16 font glyph; the screen holds as many as the
+    // video mode has room for
+    static constexpr int FONT_WIDTH = 8;
+    static constexpr int FONT_HEIGHT = 16;
+    static constexpr int COLUMNS = VGAVideo::HACTIVE / FONT_WIDTH;
+    static constexpr int ROWS = VGAVideo::VACTIVE / FONT_HEIGHT;
+    static constexpr int WIDTH = VGAVideo::HACTIVE;
+    static constexpr int HEIGHT = VGAVideo::VACTIVE;
+    
     VGAVideo *video = 0;
         
     // LUT to translate ABCDEFGH to AAAABBBBCCCCDDDDEEEEFFFFGGGGHHHH
@@ -20,6 +55,17 @@ struct VGAGraphics {
     void clear_area(int x, int y, uint8_t color, int w);
     void draw_line(int x, int y, uint8_t color, int w);
     void copy_area(int sx, int sy, int dx, int dy, int w, int h);
+    uint32_t frame_hash();
+    
+    // Pixel drawing for programs, see GfxCmd
+    void execute(const GfxCmd& cmd);
+    void fill_rect(int x, int y, int w, int h, uint8_t color);
+    void draw_rect(int x, int y, int w, int h, uint8_t color);
+    void plot_line(int x0, int y0, int x1, int y1, uint8_t color);
+    void draw_circle(int cx, int cy, int r, uint8_t color);
+    void blit_area(int sx, int sy, int dx, int dy, int w, int h);
+    void draw_text(int x, int y, uint8_t color, const char *str, int len);
+    void clear_screen(uint8_t color);
     
     
     VGAGraphics(VGAVideo *v) {
@@ -18,9 +18,22 @@
 
 void GTerm::Update()
 {
+	if (sync_update && ++sync_frames > SYNC_TIMEOUT_FRAMES)
+		sync_update = false;
 	update_changes();
 }
 
+// Partial update for racing the display: only rows CanDrawRows allows right
+// now are drawn, and the rest stay dirty for a later call. new_frame marks
+// the first call of a video frame, which is what the ?2026 timeout counts.
+// Returns the number of dirty rows left.
+int GTerm::UpdateRows(bool new_frame)
+{
+	if (new_frame && sync_update && ++sync_frames > SYNC_TIMEOUT_FRAMES)
+		sync_update = false;
+	return update_changes(true);
+}
+
 void GTerm::ProcessInput(int len, unsigned char *data)
 {
     int i;
@@ -54,6 +67,40 @@ void GTerm::ProcessInput(int len, unsigned char *data)
 	    (pending_scroll > scroll_bot-scroll_top)) update_changes();
 }
 
+// FNV-1a hash of the visible cells and cursor, for comparing the result of
+// replaying a captured escape stream against a known-good value
+unsigned long GTerm::CellHash()
+{
+    unsigned long h = 2166136261u;
+    int x, y, yp;
+
+    for (y=0; y<height; y++) {
+        yp = linenumbers[row(y)]*width;
+        for (x=0; x<width; x++) {
+            h = (h ^ text[yp+x]) * 16777619u;
+            h = (h ^ color[yp+x]) * 16777619u;
+        }
+    }
+    h = (h ^ cursor_x) * 16777619u;
+    h = (h ^ cursor_y) * 16777619u;
+    return h & 0xffffffff;
+}
+
+// Number of cells an update would redraw, and optionally of rows
+int GTerm::DirtyCells(int *rows)
+{
+    int y, n = 0, r = 0;
+
+    for (y=0; y<height; y++) {
+        if (dirty_startx[y] < width) {
+            n += dirty_endx[y] - dirty_startx[y] + 1;
+            r++;
+        }
+    }
+    if (rows) *rows = r;
+    return n;
+}
+
 void GTerm::Reset()
 {
 	reset();
@@ -81,27 +128,22 @@ void GTerm::ResizeTerminal(int w, int h)
 	cy = min(h-1, cursor_y);
 	move_cursor(cx, cy);
 
-    delete[] dirty_endx;
-    delete[] dirty_startx;
-    delete[] linenumbers;
-    delete[] tab_stops;
-	delete[] text;
-	delete[] color;
+	// A size that fits in what's allocated reuses it, laid out with the
+	// new width; otherwise grow to cover both the old and the new size,
+	// so switching back and forth doesn't allocate again
+	if (w > alloc_width || h > alloc_height) {
+		free_buffers();
+		alloc_buffers(max(w, alloc_width), max(h, alloc_height));
+	}
 
 	width = w;
 	height = h;
 
-	text         = new unsigned char[width * height];
-	color        = new unsigned short[width * height];
-	tab_stops    = new char[width];
-	linenumbers  = new short[height];
-	dirty_startx = new unsigned char[height];
-	dirty_endx   = new unsigned char[height];
-
 	save_x         = 0;
 	save_y         = 0;
 	scroll_top     = 0;
 	scroll_bot     = height-1;
+	scroll_rot     = 0;
 
     int i;
 	for (i=0; i<height; i++) {
@@ -113,6 +155,40 @@ void GTerm::ResizeTerminal(int w, int h)
 	memset(tab_stops, 0, width);
 
 	clear_area(0, 0, width-1, height-1);
+	clear_alt_screen();
+	// both screens are blank now, so call it the normal one; leaving the
+	// alternate screen later mustn't swap in the cleared buffer
+	alt_screen = false;
+}
+
+// Allocate the cell buffers and per-line arrays for up to w by h cells
+void GTerm::alloc_buffers(int w, int h)
+{
+	alloc_width = w;
+	alloc_height = h;
+
+	text         = new unsigned char[w * h];
+	color        = new unsigned int[w * h];
+	tab_stops    = new char[w];
+	linenumbers  = new short[h];
+	dirty_startx = new unsigned char[h];
+	dirty_endx   = new unsigned char[h];
+	alt_text        = new unsigned char[w * h];
+	alt_color       = new unsigned int[w * h];
+	alt_linenumbers = new short[h];
+}
+
+void GTerm::free_buffers()
+{
+    delete[] dirty_endx;
+    delete[] dirty_startx;
+    delete[] linenumbers;
+    delete[] tab_stops;
+	delete[] text;
+	delete[] color;
+	delete[] alt_linenumbers;
+	delete[] alt_text;
+	delete[] alt_color;
 }
 
 GTerm::GTerm(int w, int h) : width(w), height(h),mode_flags(0),cur_charset(0)
@@ -120,25 +196,19 @@ GTerm::GTerm(int w, int h) : width(w), height(h),mode_flags(0),cur_charset(0)
     assert(w > 0 && h > 0);
 
 	doing_update = false;
+	sync_update = false;
+	alt_screen = false;
+	ResetScrollStats();
     charset[0] = charset[1] = 'B';
 
-	text         = new unsigned char[width * height];
-	color        = new unsigned short[width * height];
-	tab_stops    = new char[width];
-	linenumbers  = new short[height];
-	dirty_startx = new unsigned char[height];
-	dirty_endx   = new unsigned char[height];
+	alloc_buffers(width, height);
 
 	reset();
+	clear_alt_screen();
 }
 
 GTerm::~GTerm()
 {
-    delete[] dirty_endx;
-    delete[] dirty_startx;
-    delete[] linenumbers;
-    delete[] tab_stops;
-	delete[] text;
-	delete[] color;
+	free_buffers();
 }
 
@@ -4,8 +4,13 @@
 #ifndef INCLUDED_GTERM_H
 #define INCLUDED_GTERM_H
 
-#define FGCOLOR(attr) (((attr)>>4) & 7)
-#define BGCOLOR(attr) (((attr)>>8) & 7)
+#include <cstring>
+
+// Cell attributes: flags in bits 0-7, foreground palette index in 8-15,
+// background palette index in 16-23.  Indices are xterm 256-color values;
+// GTerm::palette16 maps them to the 16 hardware colors when drawing.
+#define FGCOLOR(attr) (((attr)>>8) & 0xff)
+#define BGCOLOR(attr) (((attr)>>16) & 0xff)
 #define FLAG(attr) ((attr) & 0x0f)
 
 class GTerm;
@@ -19,6 +24,15 @@ struct StateOption {
 
 class GTerm {
 public:
+	// counters for output floods; lines_dropped are dirty rows that
+	// scrolled out before update_changes got to draw them
+	struct ScrollStats {
+		unsigned long lines_scrolled;
+		unsigned long lines_dropped;
+		unsigned long lines_rendered;
+		unsigned long renumbers;
+	};
+
 	// mode flags
 	enum {BOLD=1, BLINK=2, UNDERLINE=4, INVERSE=8,
 		NOEOLWRAP=16, CURSORAPPMODE=32, CURSORRELATIVE=64, 
@@ -26,24 +40,38 @@ public:
 		DEFERUPDATE=1024, DESTRUCTBS=2048, TEXTONLY=4096,
 		LOCALECHO=8192, CURSORINVISIBLE=16384} MODES;
 
+	// Release a synchronized update if the end marker hasn't arrived
+	// after this many calls to Update()
+	static constexpr int SYNC_TIMEOUT_FRAMES = 30;
+
 private:
 	// terminal info
 	int width, height, scroll_top, scroll_bot;
+	int alloc_width, alloc_height;	// size the buffers below were made for
 	unsigned char *text;
-	unsigned short *color;
+	unsigned int *color;
 	char *tab_stops;
 	short *linenumbers; // text at text[linenumbers[y]*MAXWIDTH]
+	// the inactive screen buffer, swapped with the above by ?1049/?47
+	unsigned char *alt_text;
+	unsigned int *alt_color;
+	short *alt_linenumbers;
+	bool alt_screen;
 	unsigned char* dirty_startx;
     	unsigned char* dirty_endx;
 	int pending_scroll; // >0 means scroll up
+	int scroll_rot; // rows of scroll region rotated up but not yet renumbered
 	bool doing_update;
     	bool force_wrap;
     	bool inverse_mode;
+	bool sync_update;	// ?2026 set: hold screen updates
+	int sync_frames;	// Update() calls made while held
 	
 	// terminal state
     int gfx_x, gfx_y;
 	int cursor_x, cursor_y;
 	int save_x, save_y, save_attrib;
+	int alt_save_x, alt_save_y, alt_save_mode, alt_save_fg, alt_save_bg;
 	int fg_color, bg_color;
 	int mode_flags;
  	char charset[2]; //G0,G1 charset
@@ -62,15 +90,34 @@ private:
     static StateOption gfx_state[];
 
 	// utility functions
-	void update_changes();
+	void alloc_buffers(int w, int h);
+	void free_buffers();
+	int update_changes(bool partial = false);
 	void scroll_region(int start_y, int end_y, int num);	// does clear
+	void flush_scroll();
+	void switch_screen(bool alt);
+	void clear_alt_screen();
+
+	// index into linenumbers and the dirty arrays for screen row y,
+	// allowing for a scroll that flush_scroll hasn't applied yet
+	int row(int y) {
+		if (scroll_rot && y >= scroll_top && y <= scroll_bot) {
+			y += scroll_rot;
+			if (y > scroll_bot) y -= scroll_bot-scroll_top+1;
+		}
+		return y;
+	}
 	void shift_text(int y, int start_x, int end_x, int num); // ditto
 	void clear_area(int start_x, int start_y, int end_x, int end_y);
 	void changed_line(int y, int start_x, int end_x);
 	void move_cursor(int x, int y);
 	int calc_color(int fg, int bg, int flags);
+	static int rgb_to_index(int r, int g, int b);
+	int extended_color(int n, int *color);	// 38;5;n / 38;2;r;g;b
     	void translate_charset(unsigned char *buf, unsigned char *ptr);
 
+	ScrollStats scroll_stats;
+
 	// action parameters
 	int nparam, param[30];
 	unsigned char *input_data;
@@ -80,6 +127,7 @@ private:
 
 	// terminal actions
 	void normal_input();
+	void bulk_input();
 	void set_q_mode();
 	void set_quote_mode();
 	void clear_param();
@@ -144,6 +192,9 @@ private:
     void gfx_input();
 
 public:
+	// nearest of the 16 hardware colors for each 256-color palette index
+	static const unsigned char *const palette16;
+
 	GTerm(int w, int h);
 	virtual ~GTerm();
 
@@ -153,9 +204,18 @@ public:
 	int Width() { return width; }
 	int Height() { return height; }
 	virtual void Update();
+	int UpdateRows(bool new_frame);	// draw what CanDrawRows allows
 	virtual void ExposeArea(int x, int y, int w, int h);
 	virtual void Reset();
 	
+	bool InSyncUpdate() { return sync_update; }
+	// normal_input hands runs of text to bulk_input; clear this for the
+	// line at a time path, to compare them
+	bool bulk = true;
+	const ScrollStats& GetScrollStats() { return scroll_stats; }
+	void ResetScrollStats() { memset(&scroll_stats, 0, sizeof(scroll_stats)); }
+	unsigned long CellHash();
+	int DirtyCells(int *rows = 0);
 	int GetMode() { return mode_flags; }
 	void SetMode(int mode) { mode_flags = mode; }
 	void set_mode_flag(int flag);
@@ -175,6 +235,16 @@ public:
 	virtual void Bell() { }
 	virtual void RequestSizeChange(int w, int h) { }
     virtual void PlotPixel(int x, int y, int c) { }
+	virtual bool CanUpdate() { return true; }
+	virtual bool CanDrawRows(int top, int bottom) { return true; }
+	virtual void DrawSpan(int y, int start_x, int end_x, unsigned char *text,
+		unsigned int *color, bool inverse, bool textonly) {
+		draw_span(y, start_x, end_x, text, color, inverse, textonly);
+	}
+
+	// DrawSpan's work, for children that draw from a copy of the cells
+	void draw_span(int y, int start_x, int end_x, unsigned char *text,
+		unsigned int *color, bool inverse, bool textonly);
 };
 
 #endif
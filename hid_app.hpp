@@ -3,6 +3,7 @@
 
 #include "bsp/board.h"
 #include "tusb.h"
+#include "spsc_ring.hpp"
 
 
 extern void hid_app_task();
@@ -64,21 +65,17 @@ struct HIDHost {
     void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len);
     
     
-    uint8_t key_buffer[256];
-    volatile uint8_t key_buf_head = 0;
-    volatile uint8_t key_buf_tail = 0;
+    // Keys typed, read by stdio on the other core; dropped when full
+    SPSCRing<uint8_t, 256> key_buffer;
     
     void add_buf_key(uint8_t ch) {
-        uint8_t next_tail = key_buf_tail+1;
-        if (next_tail != key_buf_head) {
-            key_buffer[key_buf_tail] = ch;
-            key_buf_tail = next_tail;
-        }
+        key_buffer.put(ch);
     }
         
     int get_buf_key() {
-        if (key_buf_head != key_buf_tail) {
-            return key_buffer[key_buf_head++];
+        uint8_t ch;
+        if (key_buffer.get(ch)) {
+            return ch;
         } else {
             return -1;
         }
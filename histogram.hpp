@@ -0,0 +1,45 @@
+#ifndef INCLUDED_HISTOGRAM_HPP
+#define INCLUDED_HISTOGRAM_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Log2-bucketed histogram of durations in microseconds. Bucket 0 counts
+// values of 0, bucket i counts [2^(i-1), 2^i), and the last bucket takes
+// everything larger.
+struct Histogram {
+    static constexpr int NBUCKETS = 20;
+
+    uint32_t buckets[NBUCKETS] = {0};
+    uint32_t count = 0;
+    uint32_t max = 0;
+    uint64_t total = 0;
+
+    static int bucket(uint32_t v) {
+        int b = v ? 32 - __builtin_clz(v) : 0;
+        return b < NBUCKETS ? b : NBUCKETS-1;
+    }
+
+    void add(uint32_t v) {
+        buckets[bucket(v)]++;
+        count++;
+        total += v;
+        if (v > max) max = v;
+    }
+
+    void reset() {
+        *this = Histogram();
+    }
+
+    // One line: count, mean, max, then "<2^i:n" for each non-empty bucket
+    void print(const char *name) const {
+        printf("%-10s n=%u avg=%u max=%u", name, (unsigned)count,
+            count ? (unsigned)(total / count) : 0u, (unsigned)max);
+        for (int i=0; i<NBUCKETS; i++) {
+            if (buckets[i]) printf(" <%u:%u", 1u << i, (unsigned)buckets[i]);
+        }
+        printf("\n");
+    }
+};
+
+#endif
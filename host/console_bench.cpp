@@ -0,0 +1,190 @@
+#include "console.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Throughput of the console with parsing and drawing on two threads, as
+// VGAConsole splits them over the two cores, against the same console
+// with both on one thread. Frames are published and skipped by the same
+// rules either way, so the difference is what the second core buys. Each
+// rate is taken once everything written has been drawn. A third thread
+// moves the beam and counts frames from the clock, standing in for the
+// scanline IRQ, and rings the drawing side's doorbell once a frame.
+//
+//   console_bench [-m MB] stream...
+//
+// The streams are written over and over, in writes of WRITE_BYTES, until
+// MB megabytes have gone. The gain from pipelining needs two CPUs; on one
+// the threads just take turns.
+
+static constexpr int WRITE_BYTES = 256;
+static constexpr double LINE_US = 1e6 / 60 / VGAVideo::VTOTAL;
+
+typedef std::chrono::steady_clock Clock;
+
+static VGAVideo *video;
+static std::atomic<bool> beam_running;
+
+static double seconds_since(Clock::time_point t)
+{
+    return std::chrono::duration<double>(Clock::now() - t).count();
+}
+
+static void beam_thread()
+{
+    Clock::time_point start = Clock::now();
+    while (beam_running) {
+        uint32_t line = seconds_since(start) * 1e6 / LINE_US;
+        uint32_t frame = line / VGAVideo::VTOTAL;
+        video->scanline = line % VGAVideo::VTOTAL;
+        if (frame != video->frame) {
+            video->frame = frame;
+            if (video->doorbell) video->doorbell->ring();
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+static bool read_file(const char *name, std::vector<uint8_t>& data)
+{
+    FILE *f = fopen(name, "rb");
+    if (!f) return false;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+    return true;
+}
+
+// Wait for the last changes to be drawn, with draw() doing the drawing.
+// They go out with the next frame's catch-up publish.
+template<typename F>
+static void drain(VGAConsole& console, F draw)
+{
+    for (;;) {
+        console.term_lock.enter();
+        bool left = console.term->DirtyCells() > 0;
+        console.term_lock.exit();
+        if (!left && !console.work_queued()) break;
+        draw();
+    }
+}
+
+static void report(const VGAConsole& console)
+{
+    const VGAConsole::RenderDecisions& rd = console.decisions;
+    printf("  render idle %u, fits %u, forced %u, skipped %u, full %u, busy %u\n",
+        (unsigned)rd.idle, (unsigned)rd.fits, (unsigned)rd.forced, (unsigned)rd.skipped,
+        (unsigned)rd.full, (unsigned)rd.busy);
+    printf("  parse %uns/byte, draw %uns/cell, queue high water %d\n",
+        (unsigned)console.parse_ns_per_byte, (unsigned)console.render_ns_per_cell,
+        (int)console.draw_queue.high_water);
+}
+
+// Both on one thread, as a single core would run them: the console's
+// render task gets a turn after every write. Frames are skipped and
+// published by the same rules as with two threads.
+static double single(const std::vector<uint8_t>& data, size_t total)
+{
+    VGAGraphics graphics(video);
+    VGATerm term(&graphics);
+    VGAMouse mouse(&graphics);
+    VGAConsole console(&term, &mouse);
+
+    Clock::time_point start = Clock::now();
+    for (size_t done = 0; done < total; ) {
+        size_t at = done % data.size();
+        int n = std::min((size_t)WRITE_BYTES, data.size() - at);
+        console.add_chars(&data[at], n);
+        done += n;
+        console.render_task();
+    }
+    double writing = seconds_since(start);
+    drain(console, [&] { console.render_task(); });
+    double all = seconds_since(start);
+
+    printf("  writing %.3fs, drained after %.3fs\n", writing, all);
+    report(console);
+    return all;
+}
+
+// The console as it runs on the board: this thread writes, another draws
+static double pipelined(const std::vector<uint8_t>& data, size_t total)
+{
+    VGAGraphics graphics(video);
+    VGATerm term(&graphics);
+    VGAMouse mouse(&graphics);
+    VGAConsole console(&term, &mouse);
+    video->doorbell = &console.doorbell;
+
+    std::atomic<bool> drawing(true);
+    std::thread drawer([&] {
+        while (drawing) {
+            console.render_task();
+            console.wait_for_work();
+        }
+    });
+
+    Clock::time_point start = Clock::now();
+    for (size_t done = 0; done < total; ) {
+        size_t at = done % data.size();
+        int n = std::min((size_t)WRITE_BYTES, data.size() - at);
+        console.add_chars(&data[at], n);
+        done += n;
+    }
+    double writing = seconds_since(start);
+    drain(console, [] { std::this_thread::sleep_for(std::chrono::milliseconds(1)); });
+    double all = seconds_since(start);
+    drawing = false;
+    drawer.join();
+    video->doorbell = 0;
+
+    printf("  writing %.3fs, drained after %.3fs, idle waits %u\n", writing, all,
+        (unsigned)console.idle_waits);
+    report(console);
+    return all;
+}
+
+int main(int argc, char **argv)
+{
+    double mb = 16;
+    int i = 1;
+    if (i + 1 < argc && !strcmp(argv[i], "-m")) {
+        mb = atof(argv[i+1]);
+        i += 2;
+    }
+    std::vector<uint8_t> data;
+    for (; i < argc; i++) {
+        if (!read_file(argv[i], data)) {
+            perror(argv[i]);
+            return 2;
+        }
+    }
+    if (data.empty()) {
+        fprintf(stderr, "usage: %s [-m MB] stream...\n", argv[0]);
+        return 2;
+    }
+    size_t total = mb * 1e6;
+
+    video = new VGAVideo(0);
+    beam_running = true;
+    std::thread beam(beam_thread);
+
+    printf("%.1f MB on %u CPUs\n", total / 1e6, std::thread::hardware_concurrency());
+    printf("one thread:\n");
+    double one = single(data, total);
+    printf("one thread:  %7.2f MB/s\n", total / 1e6 / one);
+    printf("two threads:\n");
+    double two = pipelined(data, total);
+    printf("two threads: %7.2f MB/s, %.2fx\n", total / 1e6 / two, one / two);
+
+    beam_running = false;
+    beam.join();
+    return 0;
+}
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Records the terminal sessions in this directory with script(1), on an
+# 80x30 pty like the VGA console. Keys are typed with pauses so each
+# program draws between them. Run from this directory; the results depend
+# on the programs installed, so the hashes need making again afterwards,
+# with make golden.
+
+# capture name keys command: keys is a list of strings typed 0.3s apart
+capture() {
+    local name=$1 keys=$2
+    shift 2
+    (sleep 1; for k in $keys; do printf "$k"; sleep 0.3; done; sleep 0.5) |
+        script -q -e -c "stty rows 30 cols 80; TERM=xterm-256color $*" $name.raw >/dev/null 2>&1
+    # drop the lines script adds at the start and end
+    sed '1d;$d' $name.raw > $name.vt
+    rm $name.raw
+}
+
+capture vim '40j \006 \006 /scroll\r n :split\r \027j G :q!\r :q!\r' \
+    vim -u NONE -N -i NONE -c "'syntax on'" -c "'set number'" ../../utils.cpp
+capture less '\040 \040 /wrap\r n \040 G q' less -R ../../actions.cpp
+capture top 'M P q' top -d 0.3
+capture ls '' ls -l --color=always /usr/bin
+capture gitlog '' git -c core.pager=cat log --color=always --stat -n 30
@@ -0,0 +1,102 @@
+# Writes conformance.vt, a vttest-like stream working through the escape
+# sequences GTerm handles, leaving something of each on the final screen.
+# The screen is 80x30.
+
+ESC = "\033"
+CSI = ESC + "["
+
+def main():
+    out = []
+    w = out.append
+
+    # screen alignment pattern, then clear it and home
+    w(ESC + "#8")
+    w(CSI + "2J" + CSI + "H")
+
+    # cursor movement: a box drawn with CUP, CUF, CUD, CUB, CUU
+    w(CSI + "2;2H+" + "-" * 20 + "+")
+    for y in range(3, 8):
+        w(CSI + f"{y};2H|" + CSI + "20C|")
+    w(CSI + "8;2H+" + "-" * 20 + "+")
+    w(CSI + "5;5Hcursor" + CSI + "2B" + CSI + "6Dbox" + CSI + "A*")
+
+    # erasing: a line of Xs cut down with EL and ECH
+    w(CSI + "10;1H" + "X" * 80)
+    w(CSI + "10;40H" + CSI + "K")
+    w(CSI + "10;10H" + CSI + "1K")
+    w(CSI + "10;20H" + CSI + "5X")
+
+    # insert and delete characters, and insert mode
+    w(CSI + "11;1Habcdefghij")
+    w(CSI + "11;3H" + CSI + "2@")
+    w(CSI + "11;8H" + CSI + "3P")
+    w(CSI + "4h" + CSI + "11;1HINS" + CSI + "4l")
+
+    # attributes and colors
+    w(CSI + "12;1H" + CSI + "1mbold" + CSI + "0m " + CSI + "4munder" + CSI + "0m ")
+    w(CSI + "5mblink" + CSI + "0m " + CSI + "7minverse" + CSI + "0m ")
+    for c in range(8):
+        w(CSI + f"{30 + c};{47 - c}m{c}")
+    for c in range(8):
+        w(CSI + f"{90 + c};{100 + c}m{c}")
+    w(CSI + "0m")
+    w(CSI + "13;1H")
+    for c in range(16, 256, 12):
+        w(CSI + f"38;5;{c}m#" + CSI + f"48;5;{255 - c}m#")
+    w(CSI + "38;2;255;128;0mrgb" + CSI + "0m")
+
+    # line drawing set in G0, then back
+    w(CSI + "14;1H" + ESC + "(0" + "lqqqwqqqk x   x   x mqqqvqqqj" + ESC + "(B")
+
+    # tabs: clear them all, set two and use them
+    w(CSI + "15;1H" + CSI + "3g")
+    w(CSI + "15;10H" + ESC + "H" + CSI + "15;30H" + ESC + "H")
+    w(CSI + "15;1Htab\there\tand here")
+
+    # save and restore the cursor and attributes around a move
+    w(CSI + "16;1H" + CSI + "1m" + ESC + "7" + CSI + "0m" + CSI + "16;40Hmoved" + ESC + "8saved bold" + CSI + "0m")
+
+    # scrolling region: fill it, scroll up and down, insert and delete lines
+    w(CSI + "18;24r")
+    for y in range(18, 25):
+        w(CSI + f"{y};1Hregion line {y}")
+    w(CSI + "24;1H\n\nafter two LFs")
+    w(CSI + "18;1H" + ESC + "Mreverse index")
+    w(CSI + "20;1H" + CSI + "2L" + "inserted")
+    w(CSI + "22;1H" + CSI + "M")
+    w(ESC + "Dindex" + ESC + "Enext line")
+
+    # origin mode puts the home inside the region
+    w(CSI + "?6h" + CSI + "Horigin home" + CSI + "?6l")
+
+    # LFs, without newline mode, while a wrap is pending: one at the bottom
+    # of the region keeps the wrap, one above it doesn't
+    w(CSI + "20l")
+    w(CSI + "24;71H" + "0123456789" + "\n" + "bottom")
+    w(CSI + "22;71H" + "0123456789" + "\n" + "above")
+    w(CSI + "20h")
+
+    w(CSI + "r")
+
+    # no wrap: the last column is overwritten
+    w(CSI + "?7l" + CSI + "26;70H" + "no wrap here, long" + CSI + "?7h")
+
+    # alternate screen: leaving it brings back the cursor and attributes,
+    # but modes set while on it stay set
+    w(CSI + "27;1Hnormal screen" + CSI + "1m")
+    w(CSI + "?1049h" + CSI + "0m" + CSI + "4h" + CSI + "Halternate" + CSI + "?1049l")
+    w(" back" + CSI + "4l" + CSI + "27;1Hinserted ")
+    w(CSI + "0m")
+
+    # reports: answered, but nothing on screen
+    w(CSI + "c" + CSI + "5n" + CSI + "6n")
+
+    # a long paragraph wrapping over the last lines and scrolling
+    w(CSI + "28;1H")
+    w(" ".join("word%d" % i for i in range(60)))
+
+    with open("conformance.vt", "w", newline="") as f:
+        f.write("".join(out))
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,20 @@
+{gfx.clear 1}
+{gfx.line 10 10 100 100}
+{gfx.circle 50 50 10}
+{gfx.text 60 100 "This is some text"}
+{gfx.rect 200 20 100 60 10}
+{gfx.fill 201 21 98 58 4}
+{gfx.plot 320 240 15}
+{gfx.blit 200 20 200 300 100 60}
+{func rays {n} {dotimes {i n} {gfx.line 320 240 (i * 640 / n) 479 (i % 16)}}}
+{func rings {} {for {r 200 10 -10} {gfx.circle 480 160 r (r / 10 % 16)}}}
+{func tiles {} {dotimes {y 8} {dotimes {x 8} {gfx.fill (x * 20) (300 + y * 20) 18 18 ((x + y) % 16)}}}}
+{func banner {s} {dotimes {i 16} {gfx.text (200 + i * 2) (400 + i) s i}}}
+{rays 64}
+{rings}
+{tiles}
+{banner "Drawn from Lisp, queued for the other core"}
+{gfx.vsync}
+{func slide {} {for {x 0 200 4} {gfx.fill x 440 40 30 1} {gfx.fill (x + 4) 440 40 30 12}}}
+{slide}
+{gfx.vsync}
@@ -0,0 +1,9 @@
+{gfx.clear 1}
+{gfx.plot 65600 65546}
+{gfx.line 65636 65636 65736 65736}
+{gfx.rect 65600 65600 100 100}
+{gfx.fill 65600 -65436 10 10}
+{gfx.circle 65856 65776 20}
+{gfx.blit 0 0 65856 65776 10 10}
+{gfx.text 65600 65636 "Off the screen"}
+{gfx.vsync}
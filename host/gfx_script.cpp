@@ -0,0 +1,224 @@
+#include "lisp.hpp"
+#include "graphics.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs Lisp scripts that draw with the gfx class against a framebuffer in
+// memory. As on the board, the interpreter queues commands and another
+// thread draws them, and a third moves the frame counter on at 60Hz so
+// {gfx.vsync} keeps time. Each script runs in the tree-walker and then in
+// the VM, which must both finish without an exception and draw the
+// known-good frame with the known number of commands.
+//
+//   gfx_script [-w] [-i] list
+//
+// list has a line per script, its file then its frame hash and command
+// count; files are relative to the list. -w works the hashes and counts
+// out and writes the list back instead of checking them, and -i saves
+// each final frame as a .ppm next to the list.
+
+static constexpr double FRAME_SECONDS = 1.0 / 60;
+
+typedef std::chrono::steady_clock Clock;
+
+static VGAVideo *video;
+static VGAGraphics *graphics;
+static std::atomic<bool> beam_running;
+
+static void beam_thread()
+{
+    Clock::time_point start = Clock::now();
+    while (beam_running) {
+        video->frame = std::chrono::duration<double>(Clock::now() - start).count() / FRAME_SECONDS;
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+}
+
+static bool read_file(const std::string& name, std::string& text)
+{
+    FILE *f = fopen(name.c_str(), "rb");
+    if (!f) return false;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) text.append(buf, n);
+    fclose(f);
+    return true;
+}
+
+struct Script {
+    std::string line;       // as in the list, for comments
+    std::string file;
+    uint32_t hash = 0, commands = 0;
+    std::string text;
+};
+
+struct Result {
+    uint32_t hash;
+    uint32_t commands;
+    int exceptions;
+    double ms;
+};
+
+// Run the script into a cleared framebuffer, drawing from another thread
+static Result run(const std::string& script, bool use_vm)
+{
+    memset(video->framebuffer, 0, 324 * 481);
+    GfxQueue queue;
+    Doorbell doorbell;
+    queue.doorbell = &doorbell;
+    queue.frame = &video->frame;
+
+    std::atomic<bool> drawing(true);
+    uint32_t commands = 0;
+    std::thread drawer([&] {
+        for (;;) {
+            bool last = !drawing;
+            GfxCmd *cmd;
+            int count;
+            while ((count = queue.peek(&cmd)) > 0) {
+                for (int i=0; i<count; i++) graphics->execute(cmd[i]);
+                queue.consume(count);
+                commands += count;
+            }
+            if (last) break;
+            doorbell.wait();
+        }
+    });
+
+    LispInterpreter li;
+    li.use_vm = use_vm;
+    li.addGraphics(&queue);
+    int exceptions = 0;
+    Clock::time_point start = Clock::now();
+    // A form at a time, so an exception in any of them is seen
+    TokenPtr code = li.parse_string(script);
+    for (TokenPtr form = code->list; form; form = form->next) {
+        TokenPtr r = li.evaluate_item(form);
+        if (r && r->type == Token::EXCEPTION) {
+            printf("%s: %s\n", use_vm ? "vm" : "tree", Token::inspect(r).c_str());
+            exceptions++;
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    drawing = false;
+    doorbell.ring();
+    drawer.join();
+
+    Result result = {graphics->frame_hash(), commands, exceptions, ms};
+    return result;
+}
+
+static void save_frame(const std::string& name)
+{
+    FILE *f = fopen(name.c_str(), "wb");
+    if (!f) return;
+    fprintf(f, "P6 640 480 255\n");
+    for (int y=0; y<480; y++) {
+        for (int x=0; x<640; x++) {
+            // R, G and B bits, with the fourth lightening all three
+            int p = graphics->read_pixel(x, y);
+            int on = (p & 8) ? 255 : 170, off = (p & 8) ? 85 : 0;
+            uint8_t rgb[3];
+            for (int c=0; c<3; c++) rgb[c] = (p & (1 << c)) ? on : off;
+            fwrite(rgb, 1, 3, f);
+        }
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    bool write = false, images = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "wi")) != -1) {
+        switch (opt) {
+        case 'w': write = true; break;
+        case 'i': images = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-w] [-i] list\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-w] [-i] list\n", argv[0]);
+        return 2;
+    }
+    std::string list = argv[optind];
+    std::string dir = list.find('/') != std::string::npos ? list.substr(0, list.rfind('/') + 1) : "";
+
+    std::vector<Script> scripts;
+    FILE *f = fopen(list.c_str(), "r");
+    if (!f) {
+        perror(list.c_str());
+        return 2;
+    }
+    char buf[512];
+    while (fgets(buf, sizeof(buf), f)) {
+        Script s;
+        s.line = buf;
+        char name[256];
+        unsigned hash = 0, commands = 0;
+        if (buf[0] != '#' && sscanf(buf, "%255s %x %u", name, &hash, &commands) >= 1) {
+            s.file = name;
+            s.hash = hash;
+            s.commands = commands;
+            if (!read_file(dir + s.file, s.text)) {
+                perror((dir + s.file).c_str());
+                return 2;
+            }
+        }
+        scripts.push_back(s);
+    }
+    fclose(f);
+
+    video = new VGAVideo(0);
+    graphics = new VGAGraphics(video);
+    beam_running = true;
+    std::thread beam(beam_thread);
+
+    int failures = 0;
+    for (Script& s : scripts) {
+        if (s.file.empty()) continue;
+
+        Result tree = run(s.text, false);
+        Result vm = run(s.text, true);
+        if (images) save_frame(dir + s.file.substr(s.file.rfind('/') + 1) + ".ppm");
+
+        const char *status = "ok";
+        if (tree.exceptions || vm.exceptions) {
+            status = "FAILED, raised an exception";
+            failures++;
+        } else if (vm.hash != tree.hash || vm.commands != tree.commands) {
+            status = "FAILED, the VM and tree-walker drew differently";
+            failures++;
+        } else if (write) {
+            s.hash = vm.hash;
+            s.commands = vm.commands;
+            snprintf(buf, sizeof(buf), "%-24s %08x %6u\n", s.file.c_str(), (unsigned)s.hash, (unsigned)s.commands);
+            s.line = buf;
+        } else if (vm.hash != s.hash || vm.commands != s.commands) {
+            status = "FAILED, frame or command count differs";
+            failures++;
+        }
+        printf("%-24s tree %8.2f ms, %6u commands, frame %08x\n", s.file.c_str(),
+            tree.ms, (unsigned)tree.commands, (unsigned)tree.hash);
+        printf("%-24s vm   %8.2f ms, %6u commands, frame %08x  %s\n", "",
+            vm.ms, (unsigned)vm.commands, (unsigned)vm.hash, status);
+    }
+
+    beam_running = false;
+    beam.join();
+    if (write && !failures) {
+        f = fopen(list.c_str(), "w");
+        for (const Script& s : scripts) fputs(s.line.c_str(), f);
+        fclose(f);
+    }
+    if (failures) printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,485 @@
+#include "lisp.hpp"
+#include "graphics.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <alloca.h>
+#include <chrono>
+#include <new>
+#include <string>
+
+// Benchmarks for the Lisp interpreter, run on the host. Each case times
+// one part of it and prints what it found.
+//
+//   lisp_bench [case...]
+//
+// With no cases named, all of them run. Cases that check results as well
+// make it exit with 1 if they differ.
+
+typedef std::chrono::steady_clock Clock;
+
+static int failures;
+
+static double ms_since(Clock::time_point t)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+// Every heap allocation is counted, and the bytes asked for
+static size_t heap_allocs, heap_bytes;
+
+void *operator new(size_t n)
+{
+    heap_allocs++;
+    heap_bytes += n;
+    void *p = malloc(n);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// Parsing a program of 10000 lines like {symN "strM" x.y}, so 10000
+// different symbols, first into a fresh interpreter and then again when
+// every symbol is already interned
+static void bench_parse()
+{
+    std::string prog;
+    for (int i = 0; i < 10000; i++) {
+        prog += "{sym" + std::to_string(i) + " \"str" + std::to_string(i % 100) + "\" x.y}\n";
+    }
+    double first = 1e9, again = 1e9;
+    for (int r = 0; r < 5; r++) {
+        LispInterpreter li;
+        Clock::time_point t = Clock::now();
+        TokenPtr p = li.parse_string(prog);
+        first = std::min(first, ms_since(t));
+        t = Clock::now();
+        TokenPtr q = li.parse_string(prog);
+        again = std::min(again, ms_since(t));
+    }
+    printf("parse 10000 symbols: first %.2f ms, again %.2f ms\n", first, again);
+}
+
+// The memory parsing takes, for a program of 12500 tokens. The pools keep
+// their slabs, so this runs first, before other cases have grown them.
+static void bench_tokens()
+{
+    LispInterpreter li;
+    std::string prog;
+    for (int i = 0; i < 2500; i++) prog += "{a b 1 \"s\"} ";
+    size_t n = heap_allocs, bytes = heap_bytes;
+    uint32_t tokens = Token::pool.live;
+    TokenPtr p = li.parse_string(prog);
+    printf("parse 12500 tokens: %u tokens of %u bytes, %u heap allocs, %.1f heap bytes/token\n",
+        (unsigned)(Token::pool.live - tokens), (unsigned)sizeof(Token),
+        (unsigned)(heap_allocs - n), (double)(heap_bytes - bytes) / 12500);
+}
+
+// Evaluating a function call, a nested call and an infix group, over and
+// over in the tree-walker, where the tracing is. Build with LISP_TRACE=0
+// and 1 to compare its cost.
+static void bench_eval()
+{
+    LispInterpreter li;
+    li.use_vm = false;
+    li.evaluate_string("{func f {x y} (x * 2 + y - 1)}");
+    li.evaluate_string("{set a 3}");
+    TokenPtr p = li.parse_string("{f a 4} {+ a {* 4 5} 3} (a + 4 * 5)");
+    const int N = 20000;
+    TokenPtr r;
+    size_t n = heap_allocs, bytes = heap_bytes;
+    Clock::time_point t = Clock::now();
+    for (int i = 0; i < N; i++) r = li.evaluate_item(p);
+    double ms = ms_since(t);
+    printf("eval, LISP_TRACE=%d: %.0f evals/s, %.2f heap allocs and %.0f bytes per eval -> %s\n",
+        LISP_TRACE, N / ms * 1000, (double)(heap_allocs - n) / N, (double)(heap_bytes - bytes) / N,
+        Token::inspect(r).c_str());
+}
+
+// Time expr reps times in the tree-walker and in the VM, and check they
+// agree
+static void tree_and_vm(LispInterpreter& li, const char *name, const char *expr, int reps)
+{
+    TokenPtr p = li.parse_string(expr);
+    double ms[2];
+    std::string result[2];
+    for (int vm = 0; vm < 2; vm++) {
+        li.use_vm = vm;
+        TokenPtr r = li.evaluate_item(p);    // compiles it
+        Clock::time_point t = Clock::now();
+        for (int i = 0; i < reps; i++) r = li.evaluate_item(p);
+        ms[vm] = ms_since(t) / reps;
+        result[vm] = Token::inspect(r);
+    }
+    if (result[0] != result[1]) failures++;
+    printf("%-8s tree %8.3f ms  vm %8.3f ms  x%.1f  %s -> %.24s\n", name, ms[0], ms[1],
+        ms[0] / ms[1], result[0] == result[1] ? "same" : "DIFFERENT", result[0].c_str());
+}
+
+// Recursive fib, a loop by tail recursion and building a string by
+// recursion
+static void bench_vm()
+{
+    LispInterpreter li;
+    li.evaluate_string("{func fib {n} {if (n < 2) n {+ {fib (n - 1)} {fib (n - 2)}}}}");
+    li.evaluate_string("{func sum {n acc} {if (n == 0) acc {sum (n - 1) (acc + n)}}}");
+    li.evaluate_string("{func rep {s n} {if (n <= 0) \"\" {cat s {rep s (n - 1)}}}}");
+    tree_and_vm(li, "fib", "{fib 15}", 5);
+    tree_and_vm(li, "loop", "{sum 1000 0}", 50);
+    tree_and_vm(li, "string", "{rep \"ab\" 40}", 400);
+}
+
+// The cost of a call, with three parameters and with a global read
+static void bench_calls()
+{
+    LispInterpreter li;
+    li.evaluate_string("{set g 7}");
+    li.evaluate_string("{func f3 {a b c} (a + c)}");
+    li.evaluate_string("{func glob {x} (g + x)}");
+    for (const char *call : {"{f3 1 2 3}", "{glob 1}"}) {
+        TokenPtr p = li.parse_string(call);
+        for (int vm = 0; vm < 2; vm++) {
+            li.use_vm = vm;
+            li.evaluate_item(p);
+            const int N = 100000;
+            TokenPtr r;
+            size_t n = heap_allocs;
+            Clock::time_point t = Clock::now();
+            for (int i = 0; i < N; i++) r = li.evaluate_item(p);
+            double ms = ms_since(t);
+            printf("%-12s %-4s %6.0f ns/call, %.2f heap allocs/call -> %s\n", call, vm ? "vm" : "tree",
+                ms * 1e6 / N, (double)(heap_allocs - n) / N, Token::inspect(r).c_str());
+        }
+    }
+}
+
+// Parsing infix groups, which are transformed as they're parsed
+static void bench_infix()
+{
+    LispInterpreter li;
+    li.evaluate_string("{set a 3} {set b 4}");
+    std::string prog;
+    for (int i = 0; i < 2000; i++) prog += "(a + b * 2 - (a ** 2) / 3 == 7 || b < a) (a) ";
+    double best = 1e9;
+    size_t allocs = 0;
+    uint32_t tokens = 0;
+    for (int r = 0; r < 5; r++) {
+        size_t n = heap_allocs;
+        uint32_t t0 = Token::pool.allocs;
+        Clock::time_point t = Clock::now();
+        TokenPtr p = li.parse_string(prog);
+        best = std::min(best, ms_since(t));
+        allocs = heap_allocs - n;
+        tokens = Token::pool.allocs - t0;
+    }
+    printf("parse 4000 infix groups: %.2f ms, %u heap allocs, %u tokens\n", best,
+        (unsigned)allocs, (unsigned)tokens);
+}
+
+// Tight numeric loops, which should make no tokens in the VM. One run of
+// each is timed, after a first run to compile it.
+static void bench_loops()
+{
+    LispInterpreter li;
+    li.evaluate_string("{func isum {n acc} {if (n == 0) acc {isum (n - 1) (acc + n * 3 % 7)}}}");
+    li.evaluate_string("{func fsum {n acc} {if (n == 0) acc {fsum (n - 1) (acc + n * 0.5)}}}");
+    li.evaluate_string("{func dsum {n} {set t 0.0} {dotimes {i n} {set t (t + i * 0.5 - 1)}} t}");
+    li.evaluate_string("{func wsum {n} {set i 0} {set t 0} "
+        "{while (i < n) {set t (t + (i & 255))} {set i (i + 1)}} t}");
+    const int N = 100000;
+    const char *loops[][2] = {
+        {"int-tail", "{isum 100000 0}"},
+        {"float-tail", "{fsum 100000 0}"},
+        {"dotimes", "{dsum 100000}"},
+        {"while", "{wsum 100000}"},
+    };
+    for (const auto& loop : loops) {
+        TokenPtr p = li.parse_string(loop[1]);
+        for (int vm = 0; vm < 2; vm++) {
+            li.use_vm = vm;
+            li.evaluate_item(p);
+            uint32_t tokens = Token::pool.allocs;
+            Clock::time_point t = Clock::now();
+            TokenPtr r = li.evaluate_item(p);
+            double ms = ms_since(t);
+            printf("%-10s %-4s %6.1f ns/iter, %.2f tokens/iter -> %s\n", loop[0], vm ? "vm" : "tree",
+                ms * 1e6 / N, (double)(Token::pool.allocs - tokens) / N, Token::inspect(r).c_str());
+        }
+    }
+}
+
+static int count_nodes(TokenPtr t)
+{
+    int n = 0;
+    for (; t; t = t->next) {
+        n++;
+        if (t->type == Token::LIST) n += count_nodes(t->list);
+    }
+    return n;
+}
+
+// A loop over a constant-heavy expression, and a constant expression at
+// the top level, with folding off and on
+static void bench_fold()
+{
+    const char *defs[] = {
+        "{func step {x} ((x * (1 + 2 * 3) + (255 & 15)) - (100 / 4) + (60 * 60 * 24) % (2 ** 8))}",
+        "{func run {n} {set t 0} {dotimes {i n} {set t (t + {step i} % (3 + 4 * 5))}} t}",
+    };
+    for (int fold = 0; fold < 2; fold++) {
+        for (int vm = 0; vm < 2; vm++) {
+            LispInterpreter li;
+            li.use_vm = vm;
+            li.use_folding = fold;
+            int nodes = 0;
+            for (const char *def : defs) {
+                TokenPtr p = li.parse_string(def);
+                nodes += count_nodes(p);
+                li.evaluate_item(p);
+            }
+            const int N = 20000, TOP = 100000;
+            TokenPtr run = li.parse_string("{run " + std::to_string(N) + "}");
+            TokenPtr top = li.parse_string("(3 + 4 * 5)");
+            Clock::time_point t = Clock::now();
+            TokenPtr r = li.evaluate_item(run);
+            double run_ms = ms_since(t);
+            t = Clock::now();
+            for (int i = 0; i < TOP; i++) li.evaluate_item(top);
+            double top_ms = ms_since(t);
+            printf("fold %-3s %-4s %3d nodes, loop %5.0f ns/iter, (3 + 4 * 5) %4.0f ns -> %s\n",
+                fold ? "on" : "off", vm ? "vm" : "tree", nodes, run_ms * 1e6 / N, top_ms * 1e6 / TOP,
+                Token::inspect(r).c_str());
+        }
+    }
+}
+
+// What the gfx operators cost a program, and what drawing them costs,
+// on one thread: a function queues 60 commands, then they're drawn. The
+// base loop makes the same calculations without drawing.
+static void bench_gfx()
+{
+    static VGAVideo video(0);
+    static VGAGraphics graphics(&video);
+    const char *loops[][2] = {
+        {"base loop", "{func f {n} {dotimes {i n} {identity (i * 7) (i * 3) (i % 16)}}}"},
+        {"plot", "{func f {n} {dotimes {i n} {gfx.plot (i * 7) (i * 3) (i % 16)}}}"},
+        {"line", "{func f {n} {dotimes {i n} {gfx.line 320 240 (i * 10) 0 (i % 16)}}}"},
+        {"fill 32x32", "{func f {n} {dotimes {i n} {gfx.fill (i * 9) 100 32 32 (i % 16)}}}"},
+        {"text 12ch", "{func f {n} {dotimes {i n} {gfx.text 8 (i * 8) \"Hello, world\" (i % 16)}}}"},
+    };
+    const int CALLS = 60, REPS = 2000;
+    for (const auto& loop : loops) {
+        for (int vm = 0; vm < 2; vm++) {
+            GfxQueue queue;
+            LispInterpreter li;
+            li.use_vm = vm;
+            li.addGraphics(&queue);
+            li.evaluate_string(loop[1]);
+            TokenPtr call = li.parse_string("{f " + std::to_string(CALLS) + "}");
+            double queue_ms = 0, draw_ms = 0;
+            uint32_t commands = 0;
+            for (int r = 0; r < REPS; r++) {
+                Clock::time_point t = Clock::now();
+                li.evaluate_item(call);
+                queue_ms += ms_since(t);
+                t = Clock::now();
+                GfxCmd *cmd;
+                int count;
+                while ((count = queue.peek(&cmd)) > 0) {
+                    for (int i=0; i<count; i++) graphics.execute(cmd[i]);
+                    queue.consume(count);
+                    commands += count;
+                }
+                draw_ms += ms_since(t);
+            }
+            printf("%-10s %-4s %4.0f ns/call", loop[0], vm ? "vm" : "tree", queue_ms * 1e6 / (CALLS * REPS));
+            if (commands) printf(", drawing %5.0f ns/command", draw_ms * 1e6 / commands);
+            printf("\n");
+        }
+    }
+}
+
+// Folding mustn't change what a program gives, in either mode. Each
+// program runs in a fresh interpreter with folding off and on, in the
+// tree-walker and the VM, and all four results must match. Operators that
+// take their arguments unevaluated are the ones to watch.
+static void fold_same()
+{
+    static const char *programs[] = {
+        "(3 + 4 * 5)",
+        "{+ 1 {* 2 3} {- 10 4}}",
+        "{cat \"a\" {cat \"b\" \"c\"}}",
+        "{str {+ 1 2}}",
+        "{str (1 + 2)}",
+        "{str {f {+ 1 2}}}",
+        "{! {== 1 2}}",
+        "{~ {+ 1 2}}",
+        "{neg {+ 1 2}}",
+        "{int {/ 7 2}}",
+        "{round (1 + 1.5)}",
+        "{func g {} {int (1 + 1.5)}} {g}",
+        "{func g {} {str {+ 1 2}}} {g}",
+        "{func g {x} {if (1 < 2) (x * (2 + 3)) 0}} {g 4}",
+        "{func g {} {set t 0} {dotimes {i (2 * 3)} {set t (t + 2 * 3)}} t} {g}",
+        "{func g {} {set t 0} {for {i 0 (5 * 2) 1} {set t (t + i)}} t} {g}",
+        "{func g {} {set i 0} {while (i < 2 * 5) {set i (i + 1)}} i} {g}",
+        "{identity (2 ** 8)}",
+        "{set x (60 * 60)} {set y {neg x}} y",
+    };
+    for (const char *prog : programs) {
+        std::string result[4];
+        for (int mode = 0; mode < 4; mode++) {
+            LispInterpreter li;
+            li.use_folding = mode >> 1;
+            li.use_vm = mode & 1;
+            result[mode] = Token::inspect(li.evaluate_string(prog));
+        }
+        bool same = result[1] == result[0] && result[2] == result[0] && result[3] == result[0];
+        if (!same) {
+            failures++;
+            printf("fold: %s DIFFERENT: tree %s, vm %s, folded tree %s, folded vm %s\n", prog,
+                result[0].c_str(), result[1].c_str(), result[2].c_str(), result[3].c_str());
+        }
+    }
+    printf("fold: %d programs, %s\n", (int)(sizeof(programs) / sizeof(programs[0])),
+        failures ? "FAILED" : "same with folding off and on");
+}
+
+// Recursion too deep for the stack must end in an exception, not a crash.
+// Each program runs on a thread with as much stack as the board gives the
+// interpreter, or twice that, and stack_limit set as main.cpp sets it, in
+// the tree-walker and the VM. A thread's stack also holds its TLS, so it's
+// made bigger and the extra used up before the interpreter starts. How
+// much stack a level of recursion takes is printed too. Freeing a long
+// list must fit as well. Run it with LD_BIND_NOW=1: the dynamic linker's
+// first call to a library function takes more stack than the board ever
+// needs.
+struct StackRun {
+    size_t size;
+    bool use_vm;
+    const char *prog;
+    std::string result;
+    size_t high;
+};
+
+static __attribute__((noinline)) void *stack_run(StackRun *run)
+{
+    LispInterpreter li;
+    li.use_vm = run->use_vm;
+    li.stack_limit = run->size - LISP_STACK_RESERVE;
+    li.evaluate_string("{func f {n} {if (n > 0) {+ 1 {f (n - 1)}} n}}");
+    li.evaluate_string("{func a {n} {+ 1 {b n}}}");
+    li.evaluate_string("{func b {n} {if (n > 0) {- {a (n - 1)} 1} 0}}");
+    TokenPtr r = li.evaluate_string(run->prog);
+    run->result = Token::inspect(r).substr(0, 40);
+    run->high = li.stack_high;
+    return 0;
+}
+
+static void *stack_thread(void *p)
+{
+    StackRun *run = (StackRun *)p;
+    
+    // Use up what's more than was asked for, so run->size is left below
+    // here, like main.cpp's lisp_stack
+    pthread_attr_t attr;
+    pthread_getattr_np(pthread_self(), &attr);
+    void *low;
+    size_t size;
+    pthread_attr_getstack(&attr, &low, &size);
+    pthread_attr_destroy(&attr);
+    char here;
+    uintptr_t room = (uintptr_t)&here - (uintptr_t)low;
+    if (room < run->size) {
+        run->result = "not enough stack for the test";
+        return 0;
+    }
+    volatile char *spare = (char *)alloca(room - run->size);
+    spare[0] = 0;
+    return stack_run(run);
+}
+
+static StackRun run_on_stack(size_t size, bool use_vm, const char *prog)
+{
+    StackRun run = {size, use_vm, prog, "", 0};
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, size + 16 * 1024);
+    pthread_t thread;
+    pthread_create(&thread, &attr, stack_thread, &run);
+    pthread_join(thread, 0);
+    pthread_attr_destroy(&attr);
+    return run;
+}
+
+static void stack_guard()
+{
+    for (int vm = 0; vm < 2; vm++) {
+        StackRun r = run_on_stack(32 * 1024, vm, "{f 10}");
+        printf("stack: %s, %u bytes for 10 levels\n", vm ? "vm" : "tree", (unsigned)r.high);
+    }
+    for (size_t size : {16 * 1024, 32 * 1024}) {
+        for (const char *prog : {"{f 100000}", "{a 100000}"}) {
+            for (int vm = 0; vm < 2; vm++) {
+                StackRun r = run_on_stack(size, vm, prog);
+                bool ok = r.result.find("exception") != std::string::npos;
+                if (!ok) failures++;
+                printf("stack: %2uK %-4s %-12s %5u bytes used -> %s%s\n", (unsigned)(size / 1024),
+                    vm ? "vm" : "tree", prog, (unsigned)r.high, r.result.c_str(), ok ? "" : " FAILED");
+            }
+        }
+    }
+    std::string list = "{set x '{";
+    for (int i = 0; i < 20000; i++) list += "1 ";
+    list += "}} {set x 0}";
+    StackRun r = run_on_stack(16 * 1024, false, list.c_str());
+    if (r.result != "0") failures++;
+    printf("stack: 16K freeing a list of 20000 -> %s%s\n", r.result.c_str(), r.result == "0" ? "" : " FAILED");
+}
+
+static const struct {
+    const char *name;
+    void (*run)();
+} cases[] = {
+    {"tokens", bench_tokens},
+    {"parse", bench_parse},
+    {"eval", bench_eval},
+    {"vm", bench_vm},
+    {"calls", bench_calls},
+    {"infix", bench_infix},
+    {"loops", bench_loops},
+    {"fold", bench_fold},
+    {"fold-same", fold_same},
+    {"stack", stack_guard},
+    {"gfx", bench_gfx},
+};
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        bool found = false;
+        for (const auto& c : cases) found |= !strcmp(argv[i], c.name);
+        if (!found) {
+            fprintf(stderr, "no case %s; there are:", argv[i]);
+            for (const auto& c : cases) fprintf(stderr, " %s", c.name);
+            fprintf(stderr, "\n");
+            return 2;
+        }
+    }
+    for (const auto& c : cases) {
+        bool run = argc == 1;
+        for (int i = 1; i < argc; i++) run |= !strcmp(argv[i], c.name);
+        if (run) c.run();
+    }
+    return failures ? 1 : 0;
+}
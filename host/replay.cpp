@@ -0,0 +1,249 @@
+#include "vgaterm.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Replays captured escape streams through VGATerm into a framebuffer in
+// memory, as the console would: in writes of a few hundred bytes, with an
+// update once a frame's worth has arrived. The final cells and pixels are
+// hashed and checked against the known-good values in a list. Each stream
+// is also fed a byte at a time, which takes the state machine's slow paths
+// for everything, and must leave the same cells and pixels. Then the
+// corpus is timed.
+//
+//   replay [-w] [-i] [-n] [-b] [-m MB/s] list
+//
+// list has a line per stream, its file then its cell and pixel hashes;
+// files are relative to the list. -w works the hashes out and writes the
+// list back instead of checking them, -i saves each final frame as a .ppm
+// next to the list, -n skips the timing, and -m fails the run if parsing
+// the whole corpus goes slower than that. -b replays each stream with
+// bulk_input off as well, which must leave the same cells and pixels, and
+// times parsing that way against the usual.
+
+static constexpr int WRITE_BYTES = 256;
+static constexpr int UPDATE_BYTES = 1024;
+static constexpr double TIME_SECONDS = 0.2;    // for each stream
+
+typedef std::chrono::steady_clock Clock;
+
+static VGAVideo *video;
+static VGAGraphics *graphics;
+
+struct Stream {
+    std::string line;       // as in the list, for comments
+    std::string file;
+    uint32_t cells = 0, pixels = 0;
+    std::vector<uint8_t> data;
+};
+
+struct Result {
+    uint32_t cells, pixels;
+    double parse_s, draw_s;
+};
+
+static bool read_file(const std::string& name, std::vector<uint8_t>& data)
+{
+    FILE *f = fopen(name.c_str(), "rb");
+    if (!f) return false;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+    return true;
+}
+
+// Feed data in writes of size bytes, updating at the same points whatever
+// the size, so the frames drawn can be compared
+static void replay(const std::vector<uint8_t>& data, int size, Result& r, bool bulk = true)
+{
+    memset(video->framebuffer, 0, 324 * 481);
+    VGATerm term(graphics);
+    term.hold_replies = true;
+    term.bulk = bulk;
+    r.parse_s = r.draw_s = 0;
+
+    size_t next_update = UPDATE_BYTES;
+    for (size_t i=0; i<data.size(); ) {
+        int n = std::min((size_t)size, data.size() - i);
+        n = std::min((size_t)n, next_update - i);
+        Clock::time_point t0 = Clock::now();
+        term.ProcessInput(n, (unsigned char *)&data[i]);
+        Clock::time_point t1 = Clock::now();
+        r.parse_s += std::chrono::duration<double>(t1 - t0).count();
+        term.replies.clear();
+        i += n;
+        if (i == next_update || i == data.size()) {
+            term.Update();
+            r.draw_s += std::chrono::duration<double>(Clock::now() - t1).count();
+            next_update += UPDATE_BYTES;
+        }
+    }
+    r.cells = term.CellHash();
+    r.pixels = graphics->frame_hash();
+}
+
+// Replay over and over for long enough to mean something, adding up the
+// times, and return how many bytes went through
+static double time_stream(const std::vector<uint8_t>& data, bool bulk, Result& t)
+{
+    Result r;
+    t.parse_s = t.draw_s = 0;
+    int reps = 0;
+    while (t.parse_s + t.draw_s < TIME_SECONDS) {
+        replay(data, WRITE_BYTES, r, bulk);
+        t.parse_s += r.parse_s;
+        t.draw_s += r.draw_s;
+        reps++;
+    }
+    return (double)data.size() * reps;
+}
+
+static void save_frame(const std::string& name)
+{
+    FILE *f = fopen(name.c_str(), "wb");
+    if (!f) return;
+    fprintf(f, "P6 640 480 255\n");
+    for (int y=0; y<480; y++) {
+        for (int x=0; x<640; x++) {
+            // R, G and B bits, with the fourth lightening all three
+            int p = graphics->read_pixel(x, y);
+            int on = (p & 8) ? 255 : 170, off = (p & 8) ? 85 : 0;
+            uint8_t rgb[3];
+            for (int c=0; c<3; c++) rgb[c] = (p & (1 << c)) ? on : off;
+            fwrite(rgb, 1, 3, f);
+        }
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    bool write = false, images = false, timing = true, compare_bulk = false;
+    double min_mbps = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "winbm:")) != -1) {
+        switch (opt) {
+        case 'w': write = true; break;
+        case 'i': images = true; break;
+        case 'n': timing = false; break;
+        case 'b': compare_bulk = true; break;
+        case 'm': min_mbps = atof(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-w] [-i] [-n] [-b] [-m MB/s] list\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-w] [-i] [-n] [-b] [-m MB/s] list\n", argv[0]);
+        return 2;
+    }
+    std::string list = argv[optind];
+    std::string dir = list.find('/') != std::string::npos ? list.substr(0, list.rfind('/') + 1) : "";
+
+    std::vector<Stream> streams;
+    FILE *f = fopen(list.c_str(), "r");
+    if (!f) {
+        perror(list.c_str());
+        return 2;
+    }
+    char buf[512];
+    while (fgets(buf, sizeof(buf), f)) {
+        Stream s;
+        s.line = buf;
+        char name[256];
+        unsigned cells = 0, pixels = 0;
+        if (buf[0] != '#' && sscanf(buf, "%255s %x %x", name, &cells, &pixels) >= 1) {
+            s.file = name;
+            s.cells = cells;
+            s.pixels = pixels;
+            if (!read_file(dir + s.file, s.data)) {
+                perror((dir + s.file).c_str());
+                return 2;
+            }
+        }
+        streams.push_back(s);
+    }
+    fclose(f);
+
+    video = new VGAVideo(0);
+    graphics = new VGAGraphics(video);
+
+    int failures = 0;
+    double bytes = 0, parse_s = 0, draw_s = 0, slow_bytes = 0, slow_parse_s = 0;
+    for (Stream& s : streams) {
+        if (s.file.empty()) continue;
+
+        Result r, slow, unbulked;
+        replay(s.data, WRITE_BYTES, r);
+        if (images) save_frame(dir + s.file.substr(s.file.rfind('/') + 1) + ".ppm");
+        replay(s.data, 1, slow);
+        if (compare_bulk) replay(s.data, WRITE_BYTES, unbulked, false);
+
+        const char *status = "ok";
+        if (slow.cells != r.cells || slow.pixels != r.pixels) {
+            status = "FAILED, differs a byte at a time";
+            failures++;
+        } else if (compare_bulk && (unbulked.cells != r.cells || unbulked.pixels != r.pixels)) {
+            status = "FAILED, differs without bulk_input";
+            failures++;
+        } else if (write) {
+            s.cells = r.cells;
+            s.pixels = r.pixels;
+            snprintf(buf, sizeof(buf), "%-24s %08x %08x\n", s.file.c_str(), (unsigned)s.cells, (unsigned)s.pixels);
+            s.line = buf;
+        } else if (r.cells != s.cells || r.pixels != s.pixels) {
+            status = "FAILED, hashes differ";
+            failures++;
+        }
+
+        if (!timing) {
+            printf("%-24s %8u bytes  cells %08x pixels %08x  %s\n", s.file.c_str(),
+                (unsigned)s.data.size(), (unsigned)r.cells, (unsigned)r.pixels, status);
+            continue;
+        }
+        Result t;
+        double mb = time_stream(s.data, true, t) / 1e6;
+        double mbps = mb / t.parse_s;
+        printf("%-24s %8u bytes  cells %08x pixels %08x  parse %6.2f MB/s, with drawing %6.2f MB/s  %s\n",
+            s.file.c_str(), (unsigned)s.data.size(), (unsigned)r.cells, (unsigned)r.pixels,
+            mbps, mb / (t.parse_s + t.draw_s), status);
+        bytes += mb;
+        parse_s += t.parse_s;
+        draw_s += t.draw_s;
+        if (compare_bulk) {
+            double slow_mb = time_stream(s.data, false, t) / 1e6;
+            printf("%-24s without bulk_input  parse %6.2f MB/s, bulk_input %.2fx as fast\n", "",
+                slow_mb / t.parse_s, mbps / (slow_mb / t.parse_s));
+            slow_bytes += slow_mb;
+            slow_parse_s += t.parse_s;
+        }
+    }
+
+    if (timing) {
+        double mbps = bytes / parse_s;
+        printf("all: parse %.2f MB/s, with drawing %.2f MB/s\n", mbps, bytes / (parse_s + draw_s));
+        if (compare_bulk) {
+            printf("all: without bulk_input parse %.2f MB/s, bulk_input %.2fx as fast\n",
+                slow_bytes / slow_parse_s, mbps / (slow_bytes / slow_parse_s));
+        }
+        if (mbps < min_mbps) {
+            printf("FAILED: parsing is slower than %.2f MB/s\n", min_mbps);
+            failures++;
+        }
+    }
+
+    if (write && !failures) {
+        f = fopen(list.c_str(), "w");
+        for (const Stream& s : streams) fputs(s.line.c_str(), f);
+        fclose(f);
+    }
+    if (failures) printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}
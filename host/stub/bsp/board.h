@@ -0,0 +1,5 @@
+// Host stand-in for TinyUSB's bsp/board.h; nothing from it is used
+#ifndef INCLUDED_HOST_BSP_BOARD_H
+#define INCLUDED_HOST_BSP_BOARD_H
+
+#endif
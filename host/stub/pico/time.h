@@ -0,0 +1,14 @@
+// Host stand-in for the SDK's pico/time.h: just the microsecond clock
+#ifndef INCLUDED_HOST_PICO_TIME_H
+#define INCLUDED_HOST_PICO_TIME_H
+
+#include <stdint.h>
+#include <chrono>
+
+static inline uint32_t time_us_32()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
@@ -0,0 +1,29 @@
+// Host stand-in for tusb.h: the HID types hid_app.hpp declares members of
+#ifndef INCLUDED_HOST_TUSB_H
+#define INCLUDED_HOST_TUSB_H
+
+#include <stdint.h>
+
+#define CFG_TUH_HID 4
+
+typedef struct {
+    uint8_t report_id;
+    uint8_t usage;
+    uint16_t usage_page;
+} tuh_hid_report_info_t;
+
+typedef struct {
+    uint8_t modifier;
+    uint8_t reserved;
+    uint8_t keycode[6];
+} hid_keyboard_report_t;
+
+typedef struct {
+    uint8_t buttons;
+    int8_t x;
+    int8_t y;
+    int8_t wheel;
+    int8_t pan;
+} hid_mouse_report_t;
+
+#endif
@@ -0,0 +1,30 @@
+#include "video.hpp"
+#include <string.h>
+
+// VGAVideo for host builds: the same framebuffer in memory, with nothing
+// scanning it out. hblank_isr only moves the beam, so a host program can
+// call it to stand in for the scanline IRQ.
+
+void VGAVideo::init_line_pointers()
+{
+    uint32_t bytes = 324 * 481;
+    framebuffer = new uint8_t[bytes];
+    memset(framebuffer, 0, bytes);
+    for (int i=0; i<481; i++) {
+        line_pointers[i] = framebuffer + i*324;
+    }
+}
+
+void VGAVideo::hblank_isr()
+{
+    scanline++;
+    if (scanline == VTOTAL) {
+        scanline = 0;
+        frame++;
+        if (doorbell) doorbell->ring();
+    }
+}
+
+void VGAVideo::start()
+{
+}
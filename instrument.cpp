@@ -0,0 +1,64 @@
+#include "instrument.hpp"
+
+#if INSTRUMENT
+
+#if PICO_ON_DEVICE
+#include "pico/platform.h"
+#endif
+
+InstrSection *InstrSection::first = 0;
+Trace trace;
+
+static inline uint16_t core_num()
+{
+#if PICO_ON_DEVICE
+    return get_core_num();
+#else
+    return 0;
+#endif
+}
+
+void Trace::add(uint16_t event, uint32_t arg)
+{
+    TraceRecord& r = records[next & (TRACE_SIZE-1)];
+    r.time = time_us_32();
+    r.event = event;
+    r.core = core_num();
+    r.arg = arg;
+    next++;
+}
+
+void Trace::print(FILE *f)
+{
+    uint32_t n = next < (uint32_t)TRACE_SIZE ? next : TRACE_SIZE;
+    uint32_t prev = 0;
+    for (uint32_t i=next-n; i!=next; i++) {
+        const TraceRecord& r = records[i & (TRACE_SIZE-1)];
+        fprintf(f, "%10u %+7d c%u ev %u arg %u\n", (unsigned)r.time,
+            i == next-n ? 0 : (int)(r.time - prev), r.core, r.event, (unsigned)r.arg);
+        prev = r.time;
+    }
+}
+
+void Trace::dump(FILE *f)
+{
+    uint32_t n = next < (uint32_t)TRACE_SIZE ? next : TRACE_SIZE;
+    fwrite(&n, sizeof(n), 1, f);
+    uint32_t first = (next - n) & (TRACE_SIZE-1);
+    uint32_t run = TRACE_SIZE - first;
+    if (run > n) run = n;
+    fwrite(records + first, sizeof(TraceRecord), run, f);
+    fwrite(records, sizeof(TraceRecord), n - run, f);
+    fflush(f);
+}
+
+void instrument_report()
+{
+    for (InstrSection *s = InstrSection::first; s; s = s->next) {
+        s->hist.print(s->name);
+        s->hist.reset();
+    }
+    printf("trace %u events\n", (unsigned)trace.next);
+}
+
+#endif
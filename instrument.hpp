@@ -0,0 +1,99 @@
+#ifndef INCLUDED_INSTRUMENT_HPP
+#define INCLUDED_INSTRUMENT_HPP
+
+// Timing instrumentation for the main loops. Build with INSTRUMENT=1 to get
+// it; otherwise every macro below expands to nothing and the hooks cost no
+// code or data at all.
+//
+// Sections are named stretches of code whose run times go into log2
+// histograms (see histogram.hpp). Define each one once at file scope with
+// INSTR_DEFINE_SECTION(name) and time a block with INSTR_SECTION(name).
+//
+// Trace events are (timestamp, event, arg) records kept in a fixed ring
+// that overwrites the oldest entry, so after something goes wrong the
+// last TRACE_SIZE events can be dumped as text or as raw records.
+//
+// Only pico/time.h is needed, so this works the same in a host build.
+
+#ifndef INSTRUMENT
+#define INSTRUMENT 0
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum TraceEvent : uint16_t {
+    EV_NONE = 0,
+    EV_INPUT,           // arg: bytes passed to the emulator
+    EV_RENDER,          // arg: frame number
+    EV_RENDER_SKIP,     // arg: input bytes that caused the skip
+    EV_TASK_OVERRUN,    // arg: microseconds the task took
+    EV_TASK_DEFER,      // arg: microseconds left in its window
+    EV_USER             // first free event number
+};
+
+#if INSTRUMENT
+
+#include "histogram.hpp"
+#include "pico/time.h"
+
+struct InstrSection {
+    const char *name;
+    Histogram hist;
+    InstrSection *next;
+    
+    // Sections link themselves into a list when constructed
+    static InstrSection *first;
+    InstrSection(const char *n) : name(n), next(first) { first = this; }
+};
+
+// Adds the time from construction to destruction to a section
+struct InstrTimer {
+    InstrSection& sec;
+    uint32_t start;
+    InstrTimer(InstrSection& s) : sec(s), start(time_us_32()) {}
+    ~InstrTimer() { sec.hist.add(time_us_32() - start); }
+};
+
+struct TraceRecord {
+    uint32_t time;
+    uint16_t event;
+    uint16_t core;
+    uint32_t arg;
+};
+
+// The ring has a single writer. Both cores may call trace(), but records
+// from the two can then interleave or be lost, so keep tracing to the
+// console core unless that's acceptable.
+struct Trace {
+    static constexpr int TRACE_SIZE = 512;
+    
+    TraceRecord records[TRACE_SIZE];
+    uint32_t next = 0;      // free-running count of records written
+    
+    void add(uint16_t event, uint32_t arg);
+    void print(FILE *f);    // oldest first, one line per record
+    void dump(FILE *f);     // count, then the raw records, oldest first
+    void clear() { next = 0; }
+};
+
+extern Trace trace;
+
+// Print and reset every section's histogram
+extern void instrument_report();
+
+#define INSTR_DEFINE_SECTION(name) InstrSection instr_sec_##name(#name)
+#define INSTR_SECTION(name) InstrTimer instr_timer_##name(instr_sec_##name)
+#define INSTR_TRACE(event, arg) trace.add((event), (arg))
+
+#else
+
+static inline void instrument_report() {}
+
+#define INSTR_DEFINE_SECTION(name) struct instr_sec_unused_##name
+#define INSTR_SECTION(name) do {} while (0)
+#define INSTR_TRACE(event, arg) do {} while (0)
+
+#endif
+
+#endif
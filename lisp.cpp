@@ -10,11 +10,16 @@ std::ostream& operator<<(std::ostream& os, const TokenPtr& s)
     return os;
 }
 
+std::ostream& operator<<(std::ostream& os, const TokenList& l)
+{
+    return LispInterpreter::print_list(os, l.head);
+}
+
 TokenPtr Context::make_exception(const std::string err) {
-    TokenPtr t = std::make_shared<Token>();
+    TokenPtr t = make_ref<Token>();
     t->type = Token::EXCEPTION;
     t->sym = interp->find_symbol(err);
-    t->context = shared_from_this();
+    t->context = ContextPtr(this);
     return t;
 }
 
@@ -54,23 +59,24 @@ void Context::set_global(SymbolPtr s, TokenPtr t)
 
 ContextPtr Context::get_owner(SymbolPtr& name)
 {
-    ContextPtr owner = shared_from_this();
+    ContextPtr owner(this);
+    bool first = true;
     while (name->next) {
         TokenPtr t = owner->get_local(name);
+        // The first part can come from an enclosing context, so code in a
+        // function can reach gfx.line or a global object's members
+        for (ContextPtr c = owner->parent; first && !t && c; c = c->parent) t = c->get_local(name);
+        first = false;
         if (!t) {
-            std::cout << "No such variable or context ";
-            name->print_item(std::cout);
-            std::cout << std::endl;
+            LTRACE(TR_VARS, TL_ERROR, "No such variable or context " << name->as_stringview());
             return 0;
         }
         if (t->type != Token::OBJECT && t->type != Token::CLASS) {
-            std::cout << "Variable ";
-            name->print_item(std::cout);
-            std::cout << " is not of type object or class\n";
+            LTRACE(TR_VARS, TL_ERROR, "Variable " << name->as_stringview() << " is not of type object or class");
             return 0;
         }
         
-        std::cout << "Owner of " << name << " is " << t->sym << std::endl;
+        LTRACE(TR_VARS, TL_DEBUG, "Owner of " << name << " is " << t->sym);
         
         owner = t->context;
         name = name->next;
@@ -86,6 +92,7 @@ TokenPtr Context::get_local(SymbolPtr name)
 TokenPtr Context::get(SymbolPtr& name, ContextPtr& owner)
 {
     owner = get_owner(name);    
+    if (!owner) return 0;
     TokenPtr t = owner->vars.get(name);
     if (t) return t;
     if (!owner->parent) return 0;
@@ -97,30 +104,119 @@ TokenPtr Context::get(SymbolPtr& name, ContextPtr& owner)
     }
 }
 
+Symbol::~Symbol()
+{
+    if (interns) interns->release(this);
+    delete [] p;
+}
+
+Interns::~Interns()
+{
+    for (Symbol *s : syms) {
+        if (s) s->interns = 0;
+    }
+}
+
+// FNV-1a
+uint32_t Interns::hash(const char *p, int len)
+{
+    uint32_t h = 2166136261u;
+    for (int i=0; i<len; i++) {
+        h = (h ^ (uint8_t)p[i]) * 16777619u;
+    }
+    return h;
+}
+
+void Interns::release(Symbol *s)
+{
+    uint32_t mask = table.size() - 1;
+    for (uint32_t i = hash(s->p, s->len) & mask; table[i].index != EMPTY; i = (i+1) & mask) {
+        if (table[i].index == s->index) {
+            table[i].index = DELETED;
+            break;
+        }
+    }
+    syms[s->index] = 0;
+    free_indices.push_back(s->index);
+    live--;
+}
+
+// Resize to keep the table at most a quarter full of live symbols, which
+// also clears out DELETED slots
+void Interns::rehash()
+{
+    int size = 64;
+    while (size < live * 4) size *= 2;
+    table.assign(size, Slot{EMPTY, 0});
+    used = 0;
+    uint32_t mask = size - 1;
+    for (Symbol *s : syms) {
+        if (!s) continue;
+        uint32_t h = hash(s->p, s->len);
+        uint32_t i = h & mask;
+        while (table[i].index != EMPTY) i = (i+1) & mask;
+        table[i] = {s->index, h};
+        used++;
+    }
+}
+
 SymbolPtr Interns::find(const char *p, int len)
 {
-    int free_index = -1;
-    for (int i=0; i<syms.size(); i++) {
-        SymbolPtr s = syms[i].lock();
-        if (!s) {
-            free_index = i;
-        } else {
-            if (len == s->len && 0==memcmp(p, s->p, len)) return s;
+    if ((used + 1) * 2 > (int)table.size()) rehash();
+    
+    uint32_t h = hash(p, len);
+    uint32_t mask = table.size() - 1;
+    int slot = -1;
+    uint32_t i;
+    for (i = h & mask; table[i].index != EMPTY; i = (i+1) & mask) {
+        Slot& e = table[i];
+        if (e.index == DELETED) {
+            if (slot < 0) slot = i;
+        } else if (e.hash == h) {
+            Symbol *s = syms[e.index];
+            if (len == s->len && 0==memcmp(p, s->p, len)) return SymbolPtr(s);
         }
     }
-    if (free_index < 0) {
-        free_index = syms.size();
-        syms.resize(free_index+1);
+    if (slot < 0) {
+        slot = i;
+        used++;
     }
-    SymbolPtr s = std::make_shared<Symbol>();
+    
+    int index;
+    if (free_indices.size()) {
+        index = free_indices.back();
+        free_indices.pop_back();
+    } else {
+        index = syms.size();
+        syms.push_back(0);
+    }
+    
+    SymbolPtr s = make_ref<Symbol>();
     s->len = len;
     s->p = new char[len];
-    s->index = free_index;
+    s->index = index;
+    s->interns = this;
     memcpy(s->p, p, len);
-    syms[free_index] = s;
+    syms[index] = s.get();
+    table[slot] = {index, h};
+    live++;
     return s;
 }
 
+// Pools are constant-initialized, so the static tokens below can use them
+Pool<Symbol> Symbol::pool;
+Pool<Token> Token::pool;
+Pool<Context> Context::pool;
+Pool<Code, 8> Code::pool;
+
+void LispInterpreter::print_pools()
+{
+    Symbol::pool.print("symbol");
+    Token::pool.print("token");
+    Context::pool.print("context");
+    Code::pool.print("code");
+}
+
 TokenPtr Token::zero = Token::make_int(0);
 TokenPtr Token::one = Token::make_int(1);
 TokenPtr Token::negone = Token::make_int(-1);
@@ -130,25 +226,62 @@ TokenPtr Token::bool_false = Token::make_bool(false);
 TokenPtr Token::make_string(LispInterpreter *interp, const char *p, int len)
 {
     SymbolPtr s = interp->interns.find(p, len);
-    TokenPtr l = std::make_shared<Token>();
+    TokenPtr l = make_ref<Token>();
     l->type = STR;
     l->sym = s;
     return l;
 }
 
+Value Symbol::number()
+{
+    if (numtype < 0) {
+        Parsing p(this->p, len);
+        TokenPtr t = Token::parse_number(p);
+        numtype = Token::NONE;
+        if (t && (t->type == Token::INT || t->type == Token::FLOAT)) {
+            numtype = t->type;
+            nival = t->ival; // nfval too
+        }
+    }
+    if (numtype == Token::INT) return Value::make_int(nival);
+    if (numtype == Token::FLOAT) return Value::make_float(nfval);
+    return Value::make_int(0);
+}
+
+// As as_number, without making a token
+Value Token::number_val(TokenPtr item)
+{
+    if (!item) return Value::make_int(0);
+    if (item->type == INT || item->type == FLOAT || item->type == BOOL) return Value(item);
+    if (item->type == STR) return item->sym->number();
+    return Value::make_int(0);
+}
+
 TokenPtr Token::as_number(TokenPtr item)
 {
     if (!item) return zero;
     if (item->type == BOOL) return make_bool(item->ival);
     if (item->type == INT || item->type == FLOAT) return item;
-    if (item->type == STR) {
-        Parsing p(item->sym->p, item->sym->len);
-        TokenPtr t = parse_number(p);
-        if (t->type == INT || t->type == FLOAT) return t;
-    }
+    if (item->type == STR) return item->sym->number().token();
     return zero;
 }
 
+TokenPtr Value::token() const
+{
+    switch (type) {
+    case Token::INT:
+        if (ival == 0) return Token::zero;
+        if (ival == 1) return Token::one;
+        if (ival == -1) return Token::negone;
+        return Token::make_int(ival);
+    case Token::FLOAT:
+        return Token::make_float(fval);
+    case Token::BOOL:
+        return ival ? Token::bool_true : Token::bool_false;
+    }
+    return ref;
+}
+
 TokenPtr Token::as_bool(TokenPtr item)
 {
     if (!item) return bool_false;
@@ -193,10 +326,8 @@ float Token::float_val(TokenPtr item)
     if (item->type == FLOAT) return item->fval;
     if (item->type == INT || item->type == BOOL) return item->ival;
     if (item->type == STR) {
-        Parsing p(item->sym->p, item->sym->len);
-        TokenPtr t = parse_number(p);
-        if (t->type == FLOAT) return t->fval;
-        if (t->type == INT) return t->ival;
+        Value v = item->sym->number();
+        return v.type == FLOAT ? v.fval : v.ival;
     }
     return 0;
 }
@@ -207,10 +338,8 @@ int Token::int_val(TokenPtr item)
     if (item->type == FLOAT) return item->fval;
     if (item->type == INT || item->type == BOOL) return item->ival;
     if (item->type == STR) {
-        Parsing p(item->sym->p, item->sym->len);
-        TokenPtr t = parse_number(p);
-        if (t->type == FLOAT) return t->fval;
-        if (t->type == INT) return t->ival;
+        Value v = item->sym->number();
+        return v.type == FLOAT ? (int)v.fval : v.ival;
     }
     return 0;
 }
@@ -241,16 +370,17 @@ std::string Token::inspect(TokenPtr item)
     return ss.str();
 }
 
-void LispInterpreter::addOperator(const std::string& name, built_in_f f, int precedence, int order)
+// Operators go in globals unless another context is given
+void LispInterpreter::addOperator(const std::string& name, built_in_f f, int precedence, int order, ContextPtr context)
 {
     SymbolPtr s = interns.find(name.data(), name.length());
-    TokenPtr t = std::make_shared<Token>();
+    TokenPtr t = make_ref<Token>();
     t->type = Token::OPER;
     t->oper = f;
     t->sym = s;
     t->precedence = precedence;
     t->order = order;
-    globals->set(s, t);
+    (context ? context : globals)->set(s, t);
 }
 
 void LispInterpreter::addFunction(TokenPtr list, ContextPtr context)
@@ -259,7 +389,7 @@ void LispInterpreter::addFunction(TokenPtr list, ContextPtr context)
     // XXX Check to make sure there's an args list
     // XXX Check for nulls
     if (list->type != Token::SYM) return;
-    TokenPtr t = std::make_shared<Token>();
+    TokenPtr t = make_ref<Token>();
     t->type = Token::FUNC;
     t->sym = list->sym;
     t->list = list->next;
@@ -267,24 +397,26 @@ void LispInterpreter::addFunction(TokenPtr list, ContextPtr context)
 }
 
 
-TokenPtr LispInterpreter::callFunction(SymbolPtr name, TokenPtr args, TokenPtr params, ContextPtr owner, ContextPtr caller)
+// Make the context a call runs in, with each argument evaluated in the
+// caller and set as a parameter. Returns null if there's no body to run.
+ContextPtr LispInterpreter::bind_arguments(SymbolPtr name, TokenPtr args, TokenPtr params, ContextPtr owner, ContextPtr caller)
 {
-    std::cout << "Calling func " << name << ": ";
-    print_list(std::cout, params);
-    std::cout << std::endl;
+    LTRACE(TR_CALL, TL_INFO, "Calling func " << name << ": " << TokenList{params});
     
     TokenPtr body = params->next;
     if (!body) return 0; // Empty body is okay, but we need to do no more work
             
     if (params->type != Token::LIST) {
-        std::cout << "Function doesn't start with list of args\n";
+        LTRACE(TR_CALL, TL_ERROR, "Function doesn't start with list of args");
         return 0;
     }
     
-    // Make a local variable context
-    owner = owner->make_child_function(name);
-    
+    // Make a local variable context, with a slot for each parameter
     params = params->list;
+    int nparams = 0;
+    for (TokenPtr p = params; p; p = p->next) nparams++;
+    owner = owner->make_child_function(name, nparams);
+    
     while (args && params) {
         // XXX handle wrong number of arguments
         SymbolPtr param_name = params->sym;
@@ -302,7 +434,14 @@ TokenPtr LispInterpreter::callFunction(SymbolPtr name, TokenPtr args, TokenPtr p
         args = args->next;
     }
     
-    return evaluate_list(body, owner);
+    return owner;
+}
+
+TokenPtr LispInterpreter::callFunction(SymbolPtr name, TokenPtr args, TokenPtr params, ContextPtr owner, ContextPtr caller)
+{
+    ContextPtr local = bind_arguments(name, args, params, owner, caller);
+    if (!local) return 0;
+    return evaluate_list(params->next, local);
 }
 
 // void LispInterpreter::setVariable(TokenPtr list, ContextPtr context)
@@ -322,37 +461,84 @@ TokenPtr LispInterpreter::getVariable(TokenPtr name, ContextPtr context)
     if (name->type != Token::SYM) {
         return context->make_exception("Token " + Token::inspect(name) + " is not a symbol");
     }
-    std::cout << "Get var: " << name->sym << std::endl;
+    LTRACE(TR_VARS, TL_INFO, "Get var: " << name->sym);
     return context->get(name->sym);
 }
 
-// Evaluate a single item
+// Counts how deeply evaluate_item is nested
+struct DepthGuard {
+    int& depth;
+    DepthGuard(int& d) : depth(d) { depth++; }
+    ~DepthGuard() { depth--; }
+};
+
+// Evaluate a single item. What's in tail position -- the last item of a
+// function body or of a list of lists, or what an operator hands back with
+// tail() -- is evaluated by going round the loop again rather than by
+// recursing, so tail calls run in constant C stack.
 TokenPtr LispInterpreter::evaluate_item(TokenPtr item, ContextPtr caller)
 {
     if (!item) return 0;
+    if (!caller) caller = globals;
     
-    std::cout << "Evaluating: ";
-    print_item(std::cout, item, caller);
-    std::cout << std::endl;
+    // The stack grows down from the outermost call
+    DepthGuard guard(depth);
+    char here;
+    if (depth == 1) stack_base = (uintptr_t)&here;
+    size_t used = stack_base - (uintptr_t)&here;
+    if (used > stack_high) stack_high = used;
+    if (used > stack_limit) {
+        LTRACE(TR_CALL, TL_ERROR, "Recursion too deep");
+        return caller->make_exception("Recursion too deep: " + Token::inspect(item));
+    }
     
-    if (item->quote) return item;    
-    if (!caller) caller = globals;
+    // Where the first function call was made from, which an exception
+    // coming out of it is reported against
+    ContextPtr outer;
+    TokenPtr ret;
     
-    if (item->type == Token::LIST) {
+    while (item) {
+        LTRACE(TR_EVAL, TL_DEBUG, "Evaluating: " << item);
+        
+        if (item->quote) {
+            ret = item;
+            break;
+        }
+        
+        if (item->type == Token::SYM) {
+            // Unquoted symbol gets looked up
+            ret = getVariable(item, caller);
+            break;
+        }
+        
+        if (item->type != Token::LIST) {
+            ret = item;
+            break;
+        }
+        
+        if (item->folded) {
+            ret = TokenPtr(item->folded);
+            break;
+        }
+        
         // Unquoted list is function or operator call or list of calls
         TokenPtr list = item->list;
-        
-        TokenPtr ret;
-        while (list && list->type == Token::LIST) {
-            ret = evaluate_item(list, caller);
+        while (list && list->type == Token::LIST && list->next) {
+            evaluate_item(list, caller);
             list = list->next;
         }
         
-        if (!list) return ret;
+        if (list && list->type == Token::LIST) {
+            item = list;
+            continue;
+        }
+        
+        if (!list) break;
         
         if (list->type != Token::SYM) {
-            std::cout << "Function call must start with symbol\n";
-            return caller->make_exception("Function call must start with symbol: " + Token::inspect(list));
+            LTRACE(TR_CALL, TL_ERROR, "Function call must start with symbol");
+            ret = caller->make_exception("Function call must start with symbol: " + Token::inspect(list));
+            break;
         }
         
         SymbolPtr name = list->sym;
@@ -360,45 +546,62 @@ TokenPtr LispInterpreter::evaluate_item(TokenPtr item, ContextPtr caller)
         ContextPtr owner;
         TokenPtr func = caller->get(name, owner);
         if (!func) {
-            std::cout << "Function call failed\n";
-            return caller->make_exception("Function name not found: " + Token::inspect(list));
+            LTRACE(TR_CALL, TL_ERROR, "Function call failed");
+            ret = caller->make_exception("Function name not found: " + Token::inspect(list));
+            break;
         }
         
         if (func->type == Token::CLASS) {
-            TokenPtr obj = std::make_shared<Token>();
+            TokenPtr obj = make_ref<Token>();
             obj->type = Token::OBJECT;
             //obj->sym = name;
             obj->context = func->context->make_child_object(); // Parent of object is class
+            ret = obj;
             // See if class has "_init" method
             SymbolPtr _init_sym = find_symbol("_init");
             TokenPtr _init_func = func->context->get_local(_init_sym);
             if (_init_func) {
                 if (_init_func->type != Token::FUNC) {
-                    return caller->make_exception("_init isn't a function: " + Token::inspect(list));
-                    std::cout << "Error: _init must be function\n";
+                    LTRACE(TR_CALL, TL_ERROR, "Error: _init must be function");
+                    ret = caller->make_exception("_init isn't a function: " + Token::inspect(list));
                 } else {
                     TokenPtr params_body = _init_func->list;
                     TokenPtr r = callFunction(_init_sym, args, params_body, obj->context, caller);
-                    if (r->type == Token::EXCEPTION) return caller->make_exception(r);
+                    if (r->type == Token::EXCEPTION) ret = caller->make_exception(r);
                 }
             }
-            return obj;
+            break;
         } else if (func->type == Token::OPER) {
-            return (*func->oper)(list->next, caller);
+            ret = (*func->oper)(args, caller);
+            if (ret != tail_marker) break;
+            item = tail_item;
+            caller = tail_context;
+            tail_item = 0;
+            tail_context = 0;
+            ret = 0;
         } else if (func->type == Token::FUNC) {
-            TokenPtr params_body = func->list;
-            return caller->check_exception(callFunction(name, args, params_body, owner, caller));
+            if (!outer) outer = caller;
+            if (use_vm) {
+                Code *code = get_code(func, owner);
+                if (code->ok) {
+                    ret = vm_call(name, func, code, args, owner, caller);
+                    break;
+                }
+            }
+            // Run all but the last item of the body, then carry on with that
+            ContextPtr local = bind_arguments(name, args, func->list, owner, caller);
+            if (!local) break;
+            TokenPtr body = func->list->next;
+            for (; body->next; body = body->next) evaluate_item(body, local);
+            item = body;
+            caller = local;
         } else {
-            return caller->make_exception("Function call must start with valid function or operator: " + Token::inspect(list));
+            ret = caller->make_exception("Function call must start with valid function or operator: " + Token::inspect(list));
+            break;
         }
     }
     
-    if (item->type == Token::SYM) {
-        // Unquoted symbol gets looked up
-        return getVariable(item, caller);
-    }
-    
-    return item;
+    return outer ? outer->check_exception(ret) : ret;
 }
 
 // Evaluates a function body -- rename to evaluate_rest
@@ -419,103 +622,203 @@ TokenPtr LispInterpreter::evaluate_string(const std::string& s, ContextPtr conte
     return evaluate_item(p, context);
 }
 
+// The operator a symbol names, if any. Globals are dense, so this is a
+// direct lookup by symbol index. Dotted names are never operators.
+Token *LispInterpreter::global_operator(const SymbolPtr& s)
+{
+    if (s->next) return 0;
+    const std::vector<Dictionary::Entry>& e = globals->vars.entries;
+    if (s->index >= (int)e.size()) return 0;
+    Token *oper = e[s->index].value.get();
+    return (oper && oper->type == Token::OPER) ? oper : 0;
+}
+
+// Shunting-yard, done once at parse time. The operator stack, the output
+// queue and the operand stack are chained through the tokens' own next
+// pointers, so the only allocations are the lists made for each operator.
 // XXX do error checking
 TokenPtr LispInterpreter::transform_infix(TokenPtr list)
 {
-    std::vector<TokenPtr> stack, queue;
-    int p1, p2;
-    TokenPtr oper;
+    TokenPtr stack, head, tail, next;
+    int queued = 0;
     
     if (list->type != Token::INFIX) return list;
     
-    std::cout << "Infix list: ";
-    print_list(std::cout, list);
-    std::cout << std::endl;
+    LTRACE(TR_INFIX, TL_DEBUG, "Infix list: " << TokenList{list});
     
-    TokenPtr item = list->list;
+    auto enqueue = [&](TokenPtr t) {
+        t->next = 0;
+        if (tail) tail->next = t; else head = t;
+        tail = t;
+        queued++;
+    };
     
-    while (item) {
-        switch (item->type) {
-        case Token::SYM:
-            oper = globals->get(item->sym);
-            if (oper && oper->type == Token::OPER) {
-                item->precedence = oper->precedence;
-                item->order = oper->order;
-                p1 = item->precedence;
-                std::cout << "p1=" << p1 << std::endl;
-                while (stack.size()) {
-                    TokenPtr o2 = stack.back();
-                    p2 = o2->precedence;
-                    std::cout << "p2=" << p2 << std::endl;
-                    if ((o2->order == Token::LASSOC && p2 > p1) || (o2->order != Token::LASSOC && p2 >= p1)) break;
-                    stack.pop_back();
-                    queue.push_back(o2);
-                }
-                // Make sure this item is marked as an operator
-                if (!item->precedence) item->precedence = 1;
+    for (TokenPtr item = list->list; item; item = next) {
+        next = item->next;
+        if (item->type != Token::SYM) {
+            enqueue(item);
+            continue;
+        }
+        Token *oper = global_operator(item->sym);
+        if (oper) {
+            item->precedence = oper->precedence;
+            item->order = oper->order;
+            int p1 = item->precedence;
+            while (stack) {
+                int p2 = stack->precedence;
+                if ((stack->order == Token::LASSOC && p2 > p1) || (stack->order != Token::LASSOC && p2 >= p1)) break;
+                TokenPtr o2 = stack;
+                stack = o2->next;
+                enqueue(o2);
             }
-            stack.push_back(item);
-            break;
-        case Token::INFIX:
-            queue.push_back(transform_infix(item->list));
-            break;
-        default:
-            queue.push_back(item);
-            break;
+            // Make sure this item is marked as an operator
+            if (!item->precedence) item->precedence = 1;
         }
-        
-        item = item->next;
+        item->next = stack;
+        stack = item;
     }
     
-    while (stack.size()) {
-        TokenPtr o2 = stack.back();
-        stack.pop_back();
-        queue.push_back(o2);
+    while (stack) {
+        TokenPtr o2 = stack;
+        stack = o2->next;
+        enqueue(o2);
     }
     
-    std::cout << "Queue: ";
-    for (int i=0; i<queue.size(); i++) {
-        print_item(std::cout, queue[i]);
-        std::cout << " ";
-    }
-    std::cout << std::endl;
-    
-    stack.clear();
+    LTRACE(TR_INFIX, TL_DEBUG, "Queue: " << TokenList{head});
     
-    if (queue.size() < 2) {
-        TokenPtr item = Token::make_string(this, std::string_view("identity"));
+    if (queued < 2) {
+        if (!identity_sym) identity_sym = interns.find("identity", 8);
+        TokenPtr item = make_ref<Token>();
         item->type = Token::SYM;
+        item->sym = identity_sym;
         item->precedence = 1;
         item->order = Token::UNARY;
-        queue.push_back(item);
+        enqueue(item);
     }
     
-    for (int i=0; i<queue.size(); i++) {
-        TokenPtr c = queue[i];
+    for (TokenPtr c = head; c; c = next) {
+        next = c->next;
         if (c->type == Token::SYM && c->precedence) {
             if (c->order == Token::UNARY) {
-                TokenPtr a = stack.back(); stack.pop_back();
+                if (!stack) return 0;
+                TokenPtr a = stack;
+                stack = a->next;
                 c->next = a;
                 a->next = 0;
             } else {
-                if (stack.size() < 2) return 0;
-                TokenPtr b = stack.back(); stack.pop_back();
-                TokenPtr a = stack.back(); stack.pop_back();
+                if (!stack || !stack->next) return 0;
+                TokenPtr b = stack;
+                TokenPtr a = b->next;
+                stack = a->next;
                 c->next = a;
                 a->next = b;
                 b->next = 0;
             }
-            stack.push_back(Token::as_list(c));
-        } else {
-            stack.push_back(c);
+            c = Token::as_list(c);
         }
+        c->next = stack;
+        stack = c;
     }
     
-    std::cout << "Transformed list: ";
-    print_list(std::cout, stack.back());
-    std::cout << std::endl;
+    // Anything left under the result is dropped, as before
+    stack->next = 0;
+    
+    LTRACE(TR_INFIX, TL_DEBUG, "Transformed list: " << TokenList{stack});
     
-    return stack.back();
+    return stack;
+}
+
+// Constant folding, done once on everything parsed. A call to one of the
+// folding operators whose arguments are all literals is worked out now;
+// where the call is an argument it is replaced by the result, and elsewhere
+// (a statement in a list of calls) the node keeps the result in folded.
+// {identity x} wrappers left by transform_infix are unwrapped the same way.
+// Operators are the ones bound when the code is parsed.
+//
+// Only arguments that will be evaluated are replaced: those of user
+// functions and of compiled operators that evaluate them. The arguments
+// of func and the loops are code run later, which only keeps folded, as
+// that is used just when it's evaluated. Other operators, like str or !,
+// take their arguments as they are, so those are left alone.
+enum { ARGS_LEFT, ARGS_KEPT, ARGS_REPLACED };
+
+int LispInterpreter::fold_args(const CompiledOper *&op, const TokenPtr& head)
+{
+    op = 0;
+    if (!head || head->type != Token::SYM || head->quote) return ARGS_LEFT;
+    Token *oper = global_operator(head->sym);
+    if (!oper) return ARGS_REPLACED;
+    if (oper->oper == defun_oper) return ARGS_KEPT;
+    for (const CompiledOper& c : compiled_opers) {
+        if (c.oper == oper->oper) op = &c;
+    }
+    if (!op) return ARGS_LEFT;
+    switch (op->form) {
+    case CompiledOper::WHILE:
+    case CompiledOper::DOTIMES:
+    case CompiledOper::FOR:
+        return ARGS_KEPT;
+    default:
+        return ARGS_REPLACED;
+    }
+}
+
+TokenPtr LispInterpreter::fold_constants(TokenPtr item, bool replace)
+{
+    if (!item || item->quote || item->type != Token::LIST) return item;
+    
+    // Items before the head of a call are statements, the ones after it
+    // are arguments
+    TokenPtr head = item->list;
+    while (head && head->type == Token::LIST && !head->quote) head = head->next;
+    const CompiledOper *op;
+    int args = fold_args(op, head);
+    
+    TokenPtr prev;
+    int mode = ARGS_KEPT;
+    for (TokenPtr e = item->list; e; e = e->next) {
+        if (e == head) {
+            mode = args;
+        } else if (mode != ARGS_LEFT) {
+            TokenPtr f = fold_constants(e, mode == ARGS_REPLACED);
+            if (f != e) {
+                f->next = e->next;
+                if (prev) prev->next = f; else item->list = f;
+                e = f;
+            }
+        }
+        prev = e;
+    }
+    if (!op) return item;
+    
+    TokenPtr a = head->next;
+    if (op->form == CompiledOper::BODY) {
+        if (a && !a->next && !a->quote && (replace || a->type == Token::LIST)) return a;
+        return item;
+    }
+    if (op->form != CompiledOper::FOLD && op->form != CompiledOper::FOLD_TWO) return item;
+    
+    for (TokenPtr t = a; t; t = t->next) {
+        if (t->quote) return item;
+        if (t->type != Token::INT && t->type != Token::FLOAT && t->type != Token::BOOL && t->type != Token::STR) return item;
+    }
+    
+    Value r;
+    if (op->form == CompiledOper::FOLD) {
+        r = op->initial;
+        for (TokenPtr t = a; t; t = t->next) r = op->combine(r, Value(t), this);
+    } else {
+        r = op->combine(Value(a), Value(a ? a->next : TokenPtr()), this);
+    }
+    
+    // A token of its own, as the shared constants can't be chained
+    TokenPtr c = Token::duplicate(r.token());
+    if (!c || c->type == Token::EXCEPTION) return item;
+    LTRACE(TR_INFIX, TL_DEBUG, "Folded " << item << " to " << c);
+    if (replace) return c;
+    c->refs++;
+    item->folded = c.get();
+    return item;
 }
 
 /*
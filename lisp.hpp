@@ -10,25 +10,57 @@
 #include <unordered_map>
 #include <string_view>
 #include <iostream>
-#include <memory>
+#include "pool.hpp"
+#include "lisp_trace.hpp"
+
+// How much C stack evaluate_item may use, counted from its outermost call,
+// and how many frames the VM may have, before a call fails with an
+// exception instead. Each level of non-tail recursion in tree-walked code
+// is one evaluate_item, several hundred bytes of stack, so the depth that
+// fits depends on the compiler. Whatever gives the interpreter its stack
+// sets stack_limit to the size less LISP_STACK_RESERVE, which covers what
+// runs above the outermost call and making the exception; main.cpp does.
+// The default suits a host thread's stack.
+#ifndef LISP_STACK_LIMIT
+#define LISP_STACK_LIMIT (256 * 1024)
+#endif
+#ifndef LISP_STACK_RESERVE
+#define LISP_STACK_RESERVE 4096
+#endif
+#ifndef LISP_MAX_FRAMES
+#define LISP_MAX_FRAMES 256
+#endif
 
 struct Symbol;
-typedef std::shared_ptr<Symbol> SymbolPtr;
-typedef std::weak_ptr<Symbol> SymbolWeakPtr;
+typedef Ref<Symbol> SymbolPtr;
+struct Interns;
+struct Value;
 
-struct Symbol : public std::enable_shared_from_this<Symbol> {
+struct Symbol : public RefCounted {
+    static Pool<Symbol> pool;
+    
     char *p = 0;
     int len = 0;
     int index = 0;
+    Interns *interns = 0;   // Set for interned symbols, not wrappers
+    
+    // What a string with this text is as a number, parsed the first time
+    // it's asked for: the Token type, or NONE if it isn't one
+    int8_t numtype = -1;
+    union {
+        int32_t nival;
+        float nfval;
+    };
+    
     Symbol() {}
     Symbol(char *p, int len, int ix) {
         this->p = p;
         this->len = len;
         this->index = ix;
     }
-    ~Symbol() {
-        delete [] p;
-    }
+    ~Symbol();
+    
+    Value number();
     
     SymbolPtr real;
     SymbolPtr next;
@@ -43,8 +75,8 @@ struct Symbol : public std::enable_shared_from_this<Symbol> {
     }
     
     SymbolPtr wrap() {
-        SymbolPtr s = std::make_shared<Symbol>();
-        s->real = shared_from_this();
+        SymbolPtr s = make_ref<Symbol>();
+        s->real = SymbolPtr(this);
         s->index = index;
         return s;
     }
@@ -70,8 +102,26 @@ inline std::ostream& operator<<(std::ostream& os, const SymbolPtr& s) {
     return os;
 }
 
+// Interned symbols by content. syms holds each live symbol at its index,
+// and table is an open-addressed hash of those indices using linear
+// probing. A symbol removes itself when freed and its index is reused.
 struct Interns {
-    std::vector<SymbolWeakPtr> syms;    
+    enum { EMPTY = -1, DELETED = -2 };
+    struct Slot {
+        int index;
+        uint32_t hash;
+    };
+    
+    std::vector<Symbol *> syms;
+    std::vector<int> free_indices;
+    std::vector<Slot> table;
+    int used = 0;   // Table slots that aren't EMPTY
+    int live = 0;
+    
+    ~Interns();
+    static uint32_t hash(const char *p, int len);
+    void release(Symbol *s);
+    void rehash();
     SymbolPtr find(const char *p, int len);
     SymbolPtr find(const std::string& s) {
         return find(s.data(), s.length());
@@ -83,13 +133,29 @@ struct Interns {
 
 class LispInterpreter;
 struct Token;
-typedef std::shared_ptr<Token> TokenPtr;
+typedef Ref<Token> TokenPtr;
 struct Context;
-typedef std::shared_ptr<Context> ContextPtr;
+typedef Ref<Context> ContextPtr;
 typedef TokenPtr (*built_in_f)(TokenPtr, ContextPtr);
+typedef Value (*combine_f)(const Value& a, const Value& b, LispInterpreter *interp);
+typedef Value (*native_f)(const Value *args, int n, LispInterpreter *interp);
+struct GfxQueue;
 struct Parsing;
 
-struct Token {
+// A function body compiled for the VM, see lisp_vm.cpp
+struct Code : public RefCounted {
+    static Pool<Code, 8> pool;
+    
+    bool ok = false;            // False if the body has to be tree-walked
+    uint8_t nparams = 0;
+    uint8_t nlocals = 0;        // Parameters, then variables the body sets
+    std::vector<uint8_t> ops;
+    std::vector<TokenPtr> consts;
+};
+
+struct Token : public RefCounted {
+    static Pool<Token> pool;
+    
     enum {
         LASSOC,
         RASSOC,
@@ -125,6 +191,8 @@ struct Token {
         int32_t ival; 
         float fval;
         built_in_f oper;
+        Code *code;     // FUNC: compiled body, or null until first called
+        Token *folded;  // LIST: the constant a call folded to, see fold_constants
     };
     
     TokenPtr next;
@@ -133,15 +201,24 @@ struct Token {
         next = 0;
         type = 0;
         quote = 0;
-        ival = 0;
+        oper = 0; // clears the whole union
         precedence = 0;
         order = 0;
     }
     
-    ~Token() {}
+    ~Token() {
+        // Free the rest of a list a link at a time; letting each link free
+        // the next would take stack for every element
+        while (next && next->refs == 1) {
+            TokenPtr rest = std::move(next->next);
+            next = std::move(rest);
+        }
+        if (type == FUNC && code && --code->refs == 0) destroy_ref(code);
+        if (type == LIST && folded && --folded->refs == 0) destroy_ref(folded);
+    }
     
     static TokenPtr as_list(TokenPtr head) {
-        TokenPtr l = std::make_shared<Token>();
+        TokenPtr l = make_ref<Token>();
         l->type = LIST;
         l->list = head;
         return l;
@@ -149,7 +226,7 @@ struct Token {
     
     static TokenPtr duplicate(TokenPtr item) {
         if (!item) return 0;
-        TokenPtr l = std::make_shared<Token>();
+        TokenPtr l = make_ref<Token>();
         l->type = item->type;
         l->quote = item->quote;
         l->precedence = item->precedence;
@@ -157,27 +234,29 @@ struct Token {
         l->list = item->list;
         l->sym = item->sym;
         l->oper = item->oper; // ival, etc.
+        if (l->type == FUNC && l->code) l->code->refs++;
+        if (l->type == LIST && l->folded) l->folded->refs++;
         return l;
     }
     
     static TokenPtr zero, one, negone, bool_true, bool_false;
     
     static TokenPtr make_int(int val) {
-        TokenPtr l = std::make_shared<Token>();
+        TokenPtr l = make_ref<Token>();
         l->type = INT;
         l->ival = val;
         return l;
     }
 
     static TokenPtr make_float(float val) {
-        TokenPtr l = std::make_shared<Token>();
+        TokenPtr l = make_ref<Token>();
         l->type = FLOAT;
         l->fval = val;
         return l;
     }
     
     static TokenPtr make_bool(int val) {
-        TokenPtr l = std::make_shared<Token>();
+        TokenPtr l = make_ref<Token>();
         l->type = BOOL;
         l->ival = !!val;
         return l;
@@ -192,6 +271,7 @@ struct Token {
     }
         
     static TokenPtr as_number(TokenPtr item);    
+    static Value number_val(TokenPtr item);
     static TokenPtr as_int(TokenPtr item);
     static TokenPtr as_float(TokenPtr item);    
     static TokenPtr as_string(LispInterpreter *interp, TokenPtr item);
@@ -216,6 +296,79 @@ struct Token {
 
 std::ostream& operator<<(std::ostream& os, const TokenPtr& s);
 
+// A value as the VM and the arithmetic operators hold it. Ints, floats and
+// bools are kept inline, so working with them allocates nothing; anything
+// else, null included, is a token in ref. token() gives a token either
+// way, making one for an inline value if it has to.
+struct Value {
+    uint8_t type;       // Token::INT, FLOAT or BOOL if inline, otherwise NONE
+    union {
+        int32_t ival;
+        float fval;
+    };
+    TokenPtr ref;
+    
+    Value() : type(Token::NONE), ival(0) {}
+    Value(const TokenPtr& t) : type(Token::NONE), ival(0) {
+        if (t && (t->type == Token::INT || t->type == Token::FLOAT || t->type == Token::BOOL)) {
+            type = t->type;
+            ival = t->ival; // fval too
+        } else {
+            ref = t;
+        }
+    }
+    
+    static Value make_int(int32_t v) {
+        Value r;
+        r.type = Token::INT;
+        r.ival = v;
+        return r;
+    }
+    static Value make_float(float v) {
+        Value r;
+        r.type = Token::FLOAT;
+        r.fval = v;
+        return r;
+    }
+    static Value make_bool(bool v) {
+        Value r;
+        r.type = Token::BOOL;
+        r.ival = v;
+        return r;
+    }
+    
+    bool is_inline() const { return type != Token::NONE; }
+    bool is_nil() const { return type == Token::NONE && !ref; }
+    bool is_exception() const { return type == Token::NONE && ref && ref->type == Token::EXCEPTION; }
+    
+    TokenPtr token() const;
+    
+    Value as_number() const {
+        return is_inline() ? *this : Token::number_val(ref);
+    }
+    float float_val() const {
+        if (type == Token::FLOAT) return fval;
+        if (type != Token::NONE) return ival;
+        return Token::float_val(ref);
+    }
+    int int_val() const {
+        if (type == Token::FLOAT) return fval;
+        if (type != Token::NONE) return ival;
+        return Token::int_val(ref);
+    }
+    bool bool_val() const {
+        if (type == Token::FLOAT) return fval != 0;
+        if (type != Token::NONE) return ival != 0;
+        return Token::bool_val(ref);
+    }
+};
+
+// Prints a token and everything after it, for trace messages
+struct TokenList {
+    TokenPtr head;
+};
+std::ostream& operator<<(std::ostream& os, const TokenList& l);
+
 struct Parsing {
     const char *p = 0, *q = 0;
     int len = 0;
@@ -262,31 +415,64 @@ struct Parsing {
     Parsing(const char *ptr, int l) : p(ptr), len(l) {}
 };
 
+// Variables of one context. Function, object and class contexts hold only
+// a few, kept in a flat array in the order they were set, so a function's
+// parameters are its first slots. The global context is dense instead:
+// entries is indexed by Symbol::index and unset entries have no symbol.
 struct Dictionary {
-    std::unordered_map<int, std::pair<SymbolPtr, TokenPtr>> entries;
-    void set(SymbolPtr s, TokenPtr t) {
-        std::cout << "Setting " << s << " to " << t << std::endl;
-        entries[s->index] = {s, t};
+    struct Entry {
+        SymbolPtr sym;
+        TokenPtr value;
+    };
+    std::vector<Entry> entries;
+    bool dense = false;
+    
+    // Slot holding s, or -1
+    int find(const SymbolPtr& s) const {
+        if (dense) {
+            return (s->index < (int)entries.size() && entries[s->index].sym) ? s->index : -1;
+        }
+        for (int i=0; i<(int)entries.size(); i++) {
+            if (entries[i].sym->index == s->index) return i;
+        }
+        return -1;
+    }
+    void set(const SymbolPtr& s, const TokenPtr& t) {
+        LTRACE(TR_VARS, TL_DEBUG, "Setting " << s << " to " << t);
+        int i = find(s);
+        if (i >= 0) {
+            entries[i] = {s, t};
+        } else if (dense) {
+            if (s->index >= (int)entries.size()) entries.resize(s->index + 1);
+            entries[s->index] = {s, t};
+        } else {
+            entries.push_back({s, t});
+        }
     }
-    void unset(SymbolPtr s) {
-        entries.erase(s->index);
+    void unset(const SymbolPtr& s) {
+        int i = find(s);
+        if (i < 0) return;
+        if (dense) {
+            entries[i] = {0, 0};
+        } else {
+            entries.erase(entries.begin() + i);
+        }
     }
-    TokenPtr get(SymbolPtr s) {
-        auto i = entries.find(s->index);
-        if (i == entries.end()) {
-            std::cout << "Variable " << s << " not found\n";
+    TokenPtr get(const SymbolPtr& s) {
+        int i = find(s);
+        if (i < 0) {
+            LTRACE(TR_VARS, TL_DEBUG, "Variable " << s << " not found");
             return 0;
         }
-        TokenPtr r = i->second.second;
-        std::cout << "Getting " << s << " as " << r << std::endl;
+        TokenPtr r = entries[i].value;
+        LTRACE(TR_VARS, TL_DEBUG, "Getting " << s << " as " << r);
         return r;
     }
 };
 
-typedef std::shared_ptr<Dictionary> DictionaryPtr;
-
-
-struct Context : public std::enable_shared_from_this<Context> {
+struct Context : public RefCounted {
+    static Pool<Context> pool;
+    
     LispInterpreter *interp;
     ContextPtr parent;
     Dictionary vars;
@@ -307,30 +493,32 @@ struct Context : public std::enable_shared_from_this<Context> {
     TokenPtr get_local(SymbolPtr s);
     
     ContextPtr make_child() {
-        ContextPtr p = std::make_shared<Context>(interp);
-        p->parent = shared_from_this();
+        ContextPtr p = make_ref<Context>(interp);
+        p->parent = ContextPtr(this);
         return p;
     }
     
     ContextPtr make_child_class(SymbolPtr name) {
-        ContextPtr p = std::make_shared<Context>(interp);
-        p->parent = shared_from_this();
+        ContextPtr p = make_ref<Context>(interp);
+        p->parent = ContextPtr(this);
         p->name = name;
         p->type = Token::CLASS;
         return p;
     }
     
-    ContextPtr make_child_function(SymbolPtr name) {
-        ContextPtr p = std::make_shared<Context>(interp);
-        p->parent = shared_from_this();
+    // nvars is how many variables to make room for, usually the parameters
+    ContextPtr make_child_function(SymbolPtr name, int nvars = 0) {
+        ContextPtr p = make_ref<Context>(interp);
+        if (nvars) p->vars.entries.reserve(nvars);
+        p->parent = ContextPtr(this);
         p->name = name;
         p->type = Token::FUNC;
         return p;
     }
     
     ContextPtr make_child_object() {
-        ContextPtr p = std::make_shared<Context>(interp);
-        p->parent = shared_from_this();
+        ContextPtr p = make_ref<Context>(interp);
+        p->parent = ContextPtr(this);
         p->type = Token::OBJECT;
         return p;
     }
@@ -338,15 +526,15 @@ struct Context : public std::enable_shared_from_this<Context> {
     TokenPtr make_exception(const std::string err);
     
     TokenPtr make_exception(TokenPtr child) {
-        TokenPtr t = std::make_shared<Token>();
+        TokenPtr t = make_ref<Token>();
         t->type = Token::EXCEPTION;
-        t->context = shared_from_this();
+        t->context = ContextPtr(this);
         t->next = child;        
         return t;
     }
     
     TokenPtr check_exception(TokenPtr child) {
-        if (child->type == Token::EXCEPTION) {
+        if (child && child->type == Token::EXCEPTION) {
             return make_exception(child);
         } else {
             return child;
@@ -362,7 +550,7 @@ struct Context : public std::enable_shared_from_this<Context> {
 struct LispInterpreter {
     Interns interns;
     // XXX Represent the global context as an object so that it has a name
-    ContextPtr globals = std::make_shared<Context>(this);    
+    ContextPtr globals = make_ref<Context>(this);    
     TokenPtr empty_string = Token::make_string(this, "", 0);
     
     // std::string get_full_path(SymbolPtr name, ContextPtr context = 0) {
@@ -380,10 +568,15 @@ struct LispInterpreter {
     TokenPtr parse_string(Parsing& p);
     TokenPtr parse_string(const std::string& s) {
         Parsing pa(s.data(), s.length());
-        return Token::as_list(parse_string(pa));
+        TokenPtr code = Token::as_list(parse_string(pa));
+        return use_folding ? fold_constants(code, false) : code;
     }
     TokenPtr parse_token(Parsing& p);
     TokenPtr transform_infix(TokenPtr list);
+    Token *global_operator(const SymbolPtr& s);
+    SymbolPtr identity_sym;
+    bool use_folding = true;
+    TokenPtr fold_constants(TokenPtr item, bool replace);
     
     static std::ostream& print_list(std::ostream& os, TokenPtr head, ContextPtr context = 0);
     static std::ostream& print_item(std::ostream& os, TokenPtr item, ContextPtr context = 0);
@@ -394,18 +587,95 @@ struct LispInterpreter {
     // void setVariable(TokenPtr list, ContextPtr context);
     TokenPtr getVariable(TokenPtr name, ContextPtr context);    
     TokenPtr callFunction(SymbolPtr name, TokenPtr args, TokenPtr params, ContextPtr owner, ContextPtr caller);
+    ContextPtr bind_arguments(SymbolPtr name, TokenPtr args, TokenPtr params, ContextPtr owner, ContextPtr caller);
+    
+    // An operator whose value is that of one of its arguments can return
+    // tail(item, context) rather than evaluating it. evaluate_item then
+    // carries on with the item in its own loop, so tail calls made through
+    // it don't use up the C stack.
+    TokenPtr tail_marker = make_ref<Token>();
+    TokenPtr tail_item;
+    ContextPtr tail_context;
+    TokenPtr tail(TokenPtr item, ContextPtr context) {
+        tail_item = item;
+        tail_context = context;
+        return tail_marker;
+    }
+    
+    int depth = 0;
+    size_t stack_limit = LISP_STACK_LIMIT;
+    uintptr_t stack_base = 0;       // where the outermost evaluate_item is
+    size_t stack_high = 0;          // most stack it has used
+    size_t max_frames = LISP_MAX_FRAMES;
+    
+    // Built-in operators the compiler turns into VM instructions
+    struct CompiledOper {
+        enum {
+            FOLD,       // combine all the evaluated arguments, from initial
+            FOLD_TWO,   // combine the first two evaluated arguments
+            BODY,       // evaluate all the arguments, giving the last
+            IF,
+            SET,
+            WHILE,
+            DOTIMES,
+            FOR,
+            NATIVE      // hand all the evaluated arguments to native
+        };
+        built_in_f oper;
+        int form;
+        combine_f combine;
+        Value initial;
+        native_f native;
+    };
+    std::vector<CompiledOper> compiled_opers;
+    void addCompiledOper(built_in_f oper, int form, combine_f combine = 0, Value initial = Value()) {
+        compiled_opers.push_back({oper, form, combine, initial, 0});
+    }
+    void addNativeOper(built_in_f oper, native_f native) {
+        compiled_opers.push_back({oper, CompiledOper::NATIVE, 0, Value(), native});
+    }
+    built_in_f defun_oper = 0;      // func, whose body fold_constants folds
+    int fold_args(const CompiledOper *&op, const TokenPtr& head);
+    
+    // Bytecode VM, see lisp_vm.cpp
+    struct Frame {
+        Code *code;
+        int pc;
+        int base;           // First local in vm_stack
+        ContextPtr owner;   // Where names that aren't locals are looked up
+        TokenPtr func;      // Keeps code alive
+    };
+    bool use_vm = true;
+    std::vector<Value> vm_stack;
+    std::vector<Frame> vm_frames;
+    Code *get_code(TokenPtr func, ContextPtr owner);
+    TokenPtr vm_call(SymbolPtr name, TokenPtr func, Code *code, TokenPtr args, ContextPtr owner, ContextPtr caller);
+    Value vm_run(size_t depth);
+    Value vm_fold(const CompiledOper& op, int first, int n);
+    TokenPtr call_with_values(SymbolPtr name, TokenPtr params, int first, int n, ContextPtr owner);
     
     TokenPtr evaluate_string(const std::string& name, ContextPtr context = 0);
 
-    void addOperator(const std::string& name, built_in_f f, int precedence = 0, int order = 0);
+    void addOperator(const std::string& name, built_in_f f, int precedence = 0, int order = 0, ContextPtr context = 0);
     void loadOperators();
     
+    // Drawing operators in the gfx class, see lisp_gfx.cpp
+    GfxQueue *gfx = 0;
+    void addGraphics(GfxQueue *queue);
+    
+    static void print_pools();
+    
     LispInterpreter() {
+        globals->vars.dense = true;
         loadOperators();
     }
 };
 
 
+// Evaluate the arguments of an operator and call a native function on them
+TokenPtr oper_native(TokenPtr list, ContextPtr context, native_f f);
+
+
 // inline std::ostream& operator<<(std::ostream& os, const TokenPtr& s) {
 //     os << ':' << std::string_view(s.p, s.len) << '[' << s.index << ']';
 //     return os;
@@ -0,0 +1,225 @@
+#include "lisp.hpp"
+#include "graphics.hpp"
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+
+// Drawing from Lisp. The operators live in the gfx class, so they're
+// called as {gfx.line 0 0 100 100}. Each one queues a command for the
+// drawing core and returns straight away, so a program can draw at full
+// speed; {gfx.vsync} waits for it all to reach the screen. The last
+// argument, where there's one, is the color, 0-15.
+
+// How long to wait for the drawing core before giving up on it
+static constexpr uint32_t GFX_WAIT_US = 100000;
+
+// One frame at 640x480@60
+static constexpr uint32_t FRAME_US = 16683;
+
+// Clamped to what GfxCmd's shorts hold, so far off the screen stays off it
+static int arg(const Value *args, int n, int i, int def = 0)
+{
+    int v = (i < n && !args[i].is_nil()) ? args[i].int_val() : def;
+    return std::min(std::max(v, SHRT_MIN), SHRT_MAX);
+}
+
+static Value queue(LispInterpreter *interp, const GfxCmd& cmd)
+{
+    GfxQueue *q = interp->gfx;
+    if (q->write(&cmd, 1, GFX_WAIT_US) != 1) {
+        return interp->globals->make_exception("Display isn't taking drawing commands");
+    }
+    if (q->doorbell) q->doorbell->ring();
+    return Value();
+}
+
+// A command with its position taken from arguments x and y
+static GfxCmd make_cmd(int op, const Value *args, int n, int x, int y)
+{
+    GfxCmd cmd = {};
+    cmd.op = op;
+    cmd.x = arg(args, n, x);
+    cmd.y = arg(args, n, y);
+    return cmd;
+}
+
+// {gfx.plot x y color}
+static Value gfx_plot(const Value *args, int n, LispInterpreter *interp)
+{
+    GfxCmd cmd = make_cmd(GfxCmd::PLOT, args, n, 0, 1);
+    cmd.color = arg(args, n, 2, 15);
+    return queue(interp, cmd);
+}
+
+// {gfx.line x0 y0 x1 y1 color}
+static Value gfx_line(const Value *args, int n, LispInterpreter *interp)
+{
+    GfxCmd cmd = make_cmd(GfxCmd::LINE, args, n, 0, 1);
+    cmd.w = arg(args, n, 2);
+    cmd.h = arg(args, n, 3);
+    cmd.color = arg(args, n, 4, 15);
+    return queue(interp, cmd);
+}
+
+// {gfx.rect x y w h color} and {gfx.fill x y w h color}
+static Value box(int op, const Value *args, int n, LispInterpreter *interp)
+{
+    GfxCmd cmd = make_cmd(op, args, n, 0, 1);
+    cmd.w = arg(args, n, 2);
+    cmd.h = arg(args, n, 3);
+    cmd.color = arg(args, n, 4, 15);
+    return queue(interp, cmd);
+}
+
+static Value gfx_rect(const Value *args, int n, LispInterpreter *interp)
+{
+    return box(GfxCmd::RECT, args, n, interp);
+}
+
+static Value gfx_fill(const Value *args, int n, LispInterpreter *interp)
+{
+    return box(GfxCmd::FILL, args, n, interp);
+}
+
+// {gfx.circle x y radius color}
+static Value gfx_circle(const Value *args, int n, LispInterpreter *interp)
+{
+    GfxCmd cmd = make_cmd(GfxCmd::CIRCLE, args, n, 0, 1);
+    cmd.w = arg(args, n, 2);
+    cmd.color = arg(args, n, 3, 15);
+    return queue(interp, cmd);
+}
+
+// {gfx.blit sx sy x y w h} copies pixels from sx,sy to x,y
+static Value gfx_blit(const Value *args, int n, LispInterpreter *interp)
+{
+    GfxCmd cmd = make_cmd(GfxCmd::BLIT, args, n, 2, 3);
+    cmd.sx = arg(args, n, 0);
+    cmd.sy = arg(args, n, 1);
+    cmd.w = arg(args, n, 4);
+    cmd.h = arg(args, n, 5);
+    return queue(interp, cmd);
+}
+
+// {gfx.text x y "text" color}, top left at x,y. Long text goes in pieces.
+static Value gfx_text(const Value *args, int n, LispInterpreter *interp)
+{
+    GfxCmd cmd = make_cmd(GfxCmd::TEXT, args, n, 0, 1);
+    cmd.color = arg(args, n, 3, 15);
+    std::string s = n > 2 ? Token::string_val(args[2].token()) : std::string();
+    for (size_t i = 0; i < s.size(); i += GfxCmd::TEXT_MAX) {
+        cmd.len = std::min(s.size() - i, (size_t)GfxCmd::TEXT_MAX);
+        memcpy(cmd.text, s.data() + i, cmd.len);
+        Value r = queue(interp, cmd);
+        if (r.is_exception()) return r;
+        cmd.x += cmd.len * VGAGraphics::FONT_WIDTH;
+    }
+    return Value();
+}
+
+// {gfx.clear color}
+static Value gfx_clear(const Value *args, int n, LispInterpreter *interp)
+{
+    GfxCmd cmd = {};
+    cmd.op = GfxCmd::CLEAR;
+    cmd.color = arg(args, n, 0, 0);
+    return queue(interp, cmd);
+}
+
+// {gfx.vsync} waits until everything queued has been drawn and the next
+// frame has started, and gives the frame number. Without a frame counter
+// that moves, as in a host build, it waits a frame's time instead.
+static Value gfx_vsync(const Value *args, int n, LispInterpreter *interp)
+{
+    GfxQueue *q = interp->gfx;
+    uint32_t start = time_us_32();
+    while (!q->empty()) {
+        if (time_us_32() - start >= GFX_WAIT_US) {
+            return interp->globals->make_exception("Display isn't taking drawing commands");
+        }
+    }
+    static const volatile uint32_t no_frame = 0;
+    const volatile uint32_t *frame = q->frame ? q->frame : &no_frame;
+    uint32_t was = *frame;
+    start = time_us_32();
+    while (*frame == was && time_us_32() - start < FRAME_US) {}
+    return Value::make_int(*frame);
+}
+
+static TokenPtr builtin_gfx_plot(TokenPtr list, ContextPtr context)
+{
+    return oper_native(list, context, gfx_plot);
+}
+
+static TokenPtr builtin_gfx_line(TokenPtr list, ContextPtr context)
+{
+    return oper_native(list, context, gfx_line);
+}
+
+static TokenPtr builtin_gfx_rect(TokenPtr list, ContextPtr context)
+{
+    return oper_native(list, context, gfx_rect);
+}
+
+static TokenPtr builtin_gfx_fill(TokenPtr list, ContextPtr context)
+{
+    return oper_native(list, context, gfx_fill);
+}
+
+static TokenPtr builtin_gfx_circle(TokenPtr list, ContextPtr context)
+{
+    return oper_native(list, context, gfx_circle);
+}
+
+static TokenPtr builtin_gfx_blit(TokenPtr list, ContextPtr context)
+{
+    return oper_native(list, context, gfx_blit);
+}
+
+static TokenPtr builtin_gfx_text(TokenPtr list, ContextPtr context)
+{
+    return oper_native(list, context, gfx_text);
+}
+
+static TokenPtr builtin_gfx_clear(TokenPtr list, ContextPtr context)
+{
+    return oper_native(list, context, gfx_clear);
+}
+
+static TokenPtr builtin_gfx_vsync(TokenPtr list, ContextPtr context)
+{
+    return oper_native(list, context, gfx_vsync);
+}
+
+// Make the gfx class, drawing through queue
+void LispInterpreter::addGraphics(GfxQueue *queue)
+{
+    gfx = queue;
+
+    SymbolPtr name = find_symbol("gfx");
+    TokenPtr t = make_ref<Token>();
+    t->type = Token::CLASS;
+    t->sym = name;
+    t->context = globals->make_child_class(name);
+    globals->set(name, t);
+
+    static const struct {
+        const char *name;
+        built_in_f oper;
+        native_f native;
+    } ops[] = {
+        {"plot", builtin_gfx_plot, gfx_plot},
+        {"line", builtin_gfx_line, gfx_line},
+        {"rect", builtin_gfx_rect, gfx_rect},
+        {"fill", builtin_gfx_fill, gfx_fill},
+        {"circle", builtin_gfx_circle, gfx_circle},
+        {"blit", builtin_gfx_blit, gfx_blit},
+        {"text", builtin_gfx_text, gfx_text},
+        {"clear", builtin_gfx_clear, gfx_clear},
+        {"vsync", builtin_gfx_vsync, gfx_vsync},
+    };
+    for (const auto& op : ops) {
+        addOperator(op.name, op.oper, 0, 0, t->context);
+        addNativeOper(op.oper, op.native);
+    }
+}
@@ -2,9 +2,7 @@
 
 static TokenPtr builtin_defun(TokenPtr list, ContextPtr context)
 {
-    std::cout << "defun: ";
-    LispInterpreter::print_list(std::cout, list);
-    std::cout << std::endl;
+    LTRACE(TR_CALL, TL_INFO, "defun: " << TokenList{list});
     
     if (list->type != Token::SYM) {
         // XXX inspect_rest
@@ -24,7 +22,7 @@ static TokenPtr builtin_defun(TokenPtr list, ContextPtr context)
     SymbolPtr name = list->sym;
     context = context->get_owner(name);
     
-    TokenPtr t = std::make_shared<Token>();
+    TokenPtr t = make_ref<Token>();
     t->type = Token::FUNC;
     t->sym = name;
     t->list = args;
@@ -35,9 +33,7 @@ static TokenPtr builtin_defun(TokenPtr list, ContextPtr context)
 
 static TokenPtr builtin_defclass(TokenPtr list, ContextPtr context)
 {
-    std::cout << "declass: ";
-    LispInterpreter::print_list(std::cout, list);
-    std::cout << std::endl;
+    LTRACE(TR_CALL, TL_INFO, "declass: " << TokenList{list});
     
     if (list->type != Token::SYM) {
         return context->make_exception("Class doesn't start with symbol name: " + Token::inspect(list));
@@ -46,7 +42,7 @@ static TokenPtr builtin_defclass(TokenPtr list, ContextPtr context)
     SymbolPtr name = list->sym;
     context = context->get_owner(name);
     
-    TokenPtr t = std::make_shared<Token>();
+    TokenPtr t = make_ref<Token>();
     t->type = Token::CLASS;
     t->sym = name;
     t->context = context->make_child_class(name);
@@ -60,89 +56,94 @@ static TokenPtr builtin_defclass(TokenPtr list, ContextPtr context)
     return t;
 }
 
-static TokenPtr cat_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+// Combiners work on Values, so arithmetic on ints, floats and bools makes
+// no tokens along the way
+
+static Value cat_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    return Token::make_string(interp, Token::string_val(a) + Token::string_val(b));
+    return Token::make_string(interp, Token::string_val(a.token()) + Token::string_val(b.token()));
 }
 
-static TokenPtr add_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value add_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    a = Token::as_number(a);
-    b = Token::as_number(b);
-    if (a->type == Token::FLOAT || b->type == Token::FLOAT) {
-        return Token::make_float(Token::float_val(a) + Token::float_val(b));
+    Value x = a.as_number();
+    Value y = b.as_number();
+    if (x.type == Token::FLOAT || y.type == Token::FLOAT) {
+        return Value::make_float(x.float_val() + y.float_val());
     } else {
-        return Token::make_int(a->ival + b->ival);
+        return Value::make_int(x.ival + y.ival);
     }
 }
 
-static TokenPtr mul_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value mul_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    a = Token::as_number(a);
-    b = Token::as_number(b);
-    if (a->type == Token::FLOAT || b->type == Token::FLOAT) {
-        return Token::make_float(Token::float_val(a) * Token::float_val(b));
+    Value x = a.as_number();
+    Value y = b.as_number();
+    if (x.type == Token::FLOAT || y.type == Token::FLOAT) {
+        return Value::make_float(x.float_val() * y.float_val());
     } else {
-        return Token::make_int(a->ival * b->ival);
+        return Value::make_int(x.ival * y.ival);
     }
 }
 
-static TokenPtr sub_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value sub_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    a = Token::as_number(a);
-    b = Token::as_number(b);
-    if (a->type == Token::FLOAT || b->type == Token::FLOAT) {
-        return Token::make_float(Token::float_val(a) - Token::float_val(b));
+    Value x = a.as_number();
+    Value y = b.as_number();
+    if (x.type == Token::FLOAT || y.type == Token::FLOAT) {
+        return Value::make_float(x.float_val() - y.float_val());
     } else {
-        return Token::make_int(a->ival - b->ival);
+        return Value::make_int(x.ival - y.ival);
     }
 }
 
-static TokenPtr div_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value div_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    a = Token::as_number(a);
-    b = Token::as_number(b);
-    if (a->type == Token::FLOAT || b->type == Token::FLOAT) {
-        return Token::make_float(Token::float_val(a) / Token::float_val(b));
+    Value x = a.as_number();
+    Value y = b.as_number();
+    // Integer division by zero gives inf or nan rather than trapping
+    if (x.type == Token::FLOAT || y.type == Token::FLOAT || y.ival == 0) {
+        return Value::make_float(x.float_val() / y.float_val());
     } else {
-        return Token::make_int(a->ival / b->ival);
+        return Value::make_int(x.ival / y.ival);
     }
 }
 
-static TokenPtr mod_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value mod_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    return Token::make_int(Token::int_val(a) % Token::int_val(b));
+    int32_t y = b.int_val();
+    if (!y) return Value::make_float(NAN);
+    return Value::make_int(a.int_val() % y);
 }
 
-static TokenPtr pow_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value pow_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    bool is_int = (a->type == Token::INT && b->type == Token::INT && b->ival >= 0);
-    float af = Token::float_val(a);
-    float bf = Token::float_val(b);
+    bool is_int = (a.type == Token::INT && b.type == Token::INT && b.ival >= 0);
+    float af = a.float_val();
+    float bf = b.float_val();
     float cf = pow(af, bf);
-    // std::cout << "af=" << af << " bf=" << bf << " cf=" << cf << std::endl;
     if (is_int && isfinite(cf) && cf <= std::numeric_limits<int>::max() && cf >= std::numeric_limits<int>::min()) {
-        return Token::make_int(cf);
+        return Value::make_int(cf);
     } else {
-        return Token::make_float(cf);
+        return Value::make_float(cf);
     }
 }
 
-static TokenPtr eq_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static bool eq_tokens(TokenPtr a, TokenPtr b)
 {
-    if (!a && !b) return Token::bool_true;
+    if (!a && !b) return true;
     if (!a) {
         if (b->type == Token::LIST || b->type == Token::INFIX) {
-            return !b->list ? Token::bool_true : Token::bool_false;
+            return !b->list;
         } else {
-            return Token::bool_false;
+            return false;
         }
     }
     if (!b) {
         if (a->type == Token::LIST || a->type == Token::INFIX) {
-            return !a->list ? Token::bool_true : Token::bool_false;
+            return !a->list;
         } else {
-            return Token::bool_false;
+            return false;
         }
     }
     
@@ -150,51 +151,51 @@ static TokenPtr eq_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
         a = a->list;
         b = b->list;
         while (a && b) {
-            TokenPtr c = eq_two(a, b, interp);
-            if (!c->ival) return Token::bool_false;
+            if (!eq_tokens(a, b)) return false;
+            a = a->next;
+            b = b->next;
         }
-        if (a || b) return Token::bool_false;
-        return Token::bool_true;
+        return !a && !b;
     }
     
     if (a->type == Token::SYM && b->type == Token::SYM) {
-        return a->sym->index == b->sym->index ? Token::bool_true : Token::bool_false;
+        return a->sym->index == b->sym->index;
     }
-    if (a->type == Token::SYM || b->type == Token::SYM) return Token::bool_false;
+    if (a->type == Token::SYM || b->type == Token::SYM) return false;
     
     if (a->type == Token::STR && b->type == Token::STR) {
-        return a->sym->index == b->sym->index ? Token::bool_true : Token::bool_false;
+        return a->sym->index == b->sym->index;
     }
     if (a->type == Token::STR || b->type == Token::STR) {
-        return Token::string_val(a) == Token::string_val(b) ? Token::bool_true : Token::bool_false;
+        return Token::string_val(a) == Token::string_val(b);
     }
     
     if (a->type == Token::FLOAT || b->type == Token::FLOAT) {
-        return Token::float_val(a) == Token::float_val(b) ? Token::bool_true : Token::bool_false;
+        return Token::float_val(a) == Token::float_val(b);
     }
 
     if ((a->type == Token::INT || a->type == Token::BOOL) && (b->type == Token::INT || b->type == Token::BOOL)) {
-        return a->ival == b->ival ? Token::bool_true : Token::bool_false;
+        return a->ival == b->ival;
     }
     
-    return Token::bool_false;
+    return false;
 }
 
-static TokenPtr lt_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static bool lt_tokens(TokenPtr a, TokenPtr b)
 {
-    if (!a && !b) return Token::bool_false;
+    if (!a && !b) return false;
     if (!a) {
         if (b->type == Token::LIST || b->type == Token::INFIX) {
-            return !b->list ? Token::bool_true : Token::bool_false;
+            return !b->list;
         } else {
-            return Token::bool_true;
+            return true;
         }
     }
     if (!b) {
         if (a->type == Token::LIST || a->type == Token::INFIX) {
-            return !a->list ? Token::bool_false : Token::bool_true;
+            return !!a->list;
         } else {
-            return Token::bool_false;
+            return false;
         }
     }
     
@@ -203,111 +204,147 @@ static TokenPtr lt_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
         b = b->list;
         bool got_lt = false;
         while (a && b) {
-            TokenPtr c = lt_two(a, b, interp);
-            if (c->ival) {
+            if (lt_tokens(a, b)) {
                 got_lt = true;
-            } else {
-                c = eq_two(a, b, interp);
-                if (!c->ival) return Token::bool_false;
+            } else if (!eq_tokens(a, b)) {
+                return false;
             }
+            a = a->next;
+            b = b->next;
         }
-        if (a) return Token::bool_false;
-        if (b) return Token::bool_true;
-        return got_lt ? Token::bool_true : Token::bool_false;
+        if (a) return false;
+        if (b) return true;
+        return got_lt;
     }
     
     if (a->type == Token::SYM && b->type == Token::SYM) {
-        return a->sym->index == b->sym->index ? Token::bool_false : Token::bool_true;
+        return a->sym->index != b->sym->index;
     }
-    if (a->type == Token::SYM || b->type == Token::SYM) return Token::bool_false;
+    if (a->type == Token::SYM || b->type == Token::SYM) return false;
     
     if (a->type == Token::STR && b->type == Token::STR) {
-        if (a->sym->index == b->sym->index) return Token::bool_false;
+        if (a->sym->index == b->sym->index) return false;
     }
     if (a->type == Token::STR || b->type == Token::STR) {
-        int c = strcmp(Token::string_val(a).c_str(), Token::string_val(b).c_str());
-        return (c < 0) ? Token::bool_true : Token::bool_false;
+        return strcmp(Token::string_val(a).c_str(), Token::string_val(b).c_str()) < 0;
     }
     
     if (a->type == Token::FLOAT || b->type == Token::FLOAT) {
-        return Token::float_val(a) < Token::float_val(b) ? Token::bool_true : Token::bool_false;
+        return Token::float_val(a) < Token::float_val(b);
     }
 
     if ((a->type == Token::INT || a->type == Token::BOOL) && (b->type == Token::INT || b->type == Token::BOOL)) {
-        return a->ival < b->ival ? Token::bool_true : Token::bool_false;
+        return a->ival < b->ival;
     }
     
-    return Token::bool_false;
+    return false;
+}
+
+// Comparisons between inline values are done directly, as the token
+// versions would do them
+static bool eq_values(const Value& a, const Value& b)
+{
+    if (a.is_inline() && b.is_inline()) {
+        if (a.type == Token::FLOAT || b.type == Token::FLOAT) return a.float_val() == b.float_val();
+        return a.ival == b.ival;
+    }
+    return eq_tokens(a.token(), b.token());
 }
 
-static TokenPtr gt_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static bool lt_values(const Value& a, const Value& b)
 {
-    return lt_two(b, a, interp);
+    if (a.is_inline() && b.is_inline()) {
+        if (a.type == Token::FLOAT || b.type == Token::FLOAT) return a.float_val() < b.float_val();
+        return a.ival < b.ival;
+    }
+    return lt_tokens(a.token(), b.token());
 }
 
-static TokenPtr le_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value eq_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    return lt_two(b, a, interp)->ival ? Token::bool_false : Token::bool_true;
+    return Value::make_bool(eq_values(a, b));
 }
 
-static TokenPtr ge_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value ne_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    return lt_two(a, b, interp)->ival ? Token::bool_false : Token::bool_true;
+    return Value::make_bool(!eq_values(a, b));
 }
 
-static TokenPtr ne_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value lt_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    TokenPtr c = eq_two(a, b, interp);
-    return c->ival ? Token::bool_false : Token::bool_true;
+    return Value::make_bool(lt_values(a, b));
 }
 
-static TokenPtr and_two_bitwise(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value gt_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    return Token::make_int(Token::int_val(a) & Token::int_val(b));
+    return Value::make_bool(lt_values(b, a));
 }
 
-static TokenPtr and_two_bool(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value le_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    return (Token::bool_val(a) && Token::bool_val(b)) ? Token::bool_true : Token::bool_false;
+    return Value::make_bool(!lt_values(b, a));
 }
 
-static TokenPtr or_two(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value ge_two(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    return Token::make_int(Token::int_val(a) | Token::int_val(b));
+    return Value::make_bool(!lt_values(a, b));
 }
 
-static TokenPtr or_two_bitwise(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value and_two_bitwise(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    return Token::make_int(Token::int_val(a) | Token::int_val(b));
+    return Value::make_int(a.int_val() & b.int_val());
 }
 
-static TokenPtr or_two_bool(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value and_two_bool(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    return (Token::bool_val(a) || Token::bool_val(b)) ? Token::bool_true : Token::bool_false;
+    return Value::make_bool(a.bool_val() && b.bool_val());
 }
 
-static TokenPtr xor_two_bitwise(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value or_two_bitwise(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    return Token::make_int(Token::int_val(a) ^ Token::int_val(b));
+    return Value::make_int(a.int_val() | b.int_val());
 }
 
-static TokenPtr xor_two_bool(TokenPtr a, TokenPtr b, LispInterpreter *interp)
+static Value or_two_bool(const Value& a, const Value& b, LispInterpreter *interp)
 {
-    return (Token::bool_val(a) != Token::bool_val(b)) ? Token::bool_true : Token::bool_false;
+    return Value::make_bool(a.bool_val() || b.bool_val());
 }
 
+static Value xor_two_bitwise(const Value& a, const Value& b, LispInterpreter *interp)
+{
+    return Value::make_int(a.int_val() ^ b.int_val());
+}
 
-typedef TokenPtr (*combine_f)(TokenPtr a, TokenPtr b, LispInterpreter *interp);
+static Value xor_two_bool(const Value& a, const Value& b, LispInterpreter *interp)
+{
+    return Value::make_bool(a.bool_val() != b.bool_val());
+}
 
 
-static TokenPtr oper_reduce_list(TokenPtr list, ContextPtr context, TokenPtr initial, combine_f comb)
+
+static TokenPtr oper_reduce_list(TokenPtr list, ContextPtr context, Value initial, combine_f comb)
 {
     while (list) {
         TokenPtr item = context->interp->evaluate_item(list, context);
+        if (item && item->type == Token::EXCEPTION) return item;
         initial = comb(initial, item, context->interp);
         list = list->next;
     }
-    return initial;
+    return initial.token();
+}
+
+// Natives are handed the first few arguments; any more are still evaluated
+TokenPtr oper_native(TokenPtr list, ContextPtr context, native_f f)
+{
+    static constexpr int MAX_ARGS = 8;
+    Value args[MAX_ARGS];
+    int n = 0;
+    for (; list; list = list->next) {
+        TokenPtr item = context->interp->evaluate_item(list, context);
+        if (item && item->type == Token::EXCEPTION) return item;
+        if (n < MAX_ARGS) args[n++] = item;
+    }
+    return f(args, n, context->interp).token();
 }
 
 static TokenPtr builtin_add(TokenPtr list, ContextPtr context)
@@ -361,13 +398,15 @@ static TokenPtr oper_reduce_two(TokenPtr list, ContextPtr context, combine_f com
     
     if (list) {
         a = context->interp->evaluate_item(list, context);
+        if (a && a->type == Token::EXCEPTION) return a;
         list = list->next;
     }
     if (list) {
         b = context->interp->evaluate_item(list, context);
+        if (b && b->type == Token::EXCEPTION) return b;
     }
     
-    return comb(a, b, context->interp);
+    return comb(a, b, context->interp).token();
 }
 
 static TokenPtr builtin_sub(TokenPtr list, ContextPtr context)
@@ -448,7 +487,9 @@ static TokenPtr builtin_neg(TokenPtr item, ContextPtr context)
 
 static TokenPtr builtin_identity(TokenPtr item, ContextPtr context)
 {
-    return context->interp->evaluate_list(item);
+    if (!item) return 0;
+    for (; item->next; item = item->next) context->interp->evaluate_item(item, context);
+    return context->interp->tail(item, context);
 }
 
 static TokenPtr builtin_str(TokenPtr item, ContextPtr context)
@@ -512,10 +553,10 @@ static TokenPtr builtin_set_obj(TokenPtr item, ContextPtr caller)
     SymbolPtr name = item->sym;    
     ContextPtr owner = caller;
     
-    std::cout << "Type=" << int(owner->type) << " name=" << owner->name << std::endl;
+    LTRACE(TR_VARS, TL_DEBUG, "Type=" << int(owner->type) << " name=" << owner->name);
     while (owner && owner->type != Token::OBJECT) {
         owner = owner->parent;
-        if (owner) std::cout << "Type=" << int(owner->type) << " name=" << owner->name << std::endl;
+        if (owner) LTRACE(TR_VARS, TL_DEBUG, "Type=" << int(owner->type) << " name=" << owner->name);
     }
     if (!owner) {
         return caller->make_exception(std::string("No object context for: ") + std::string(name->as_stringview()));
@@ -525,6 +566,170 @@ static TokenPtr builtin_set_obj(TokenPtr item, ContextPtr caller)
     return val;
 }
 
+// {trace categories level} sets which trace messages are kept, see
+// lisp_trace.hpp. Either may be left off. Returns the old categories.
+static TokenPtr builtin_trace(TokenPtr list, ContextPtr context)
+{
+#if LISP_TRACE
+    TokenPtr old = Token::make_int(lisp_trace.categories);
+    if (list) {
+        lisp_trace.categories = Token::int_val(context->interp->evaluate_item(list, context));
+        list = list->next;
+    }
+    if (list) {
+        lisp_trace.level = Token::int_val(context->interp->evaluate_item(list, context));
+    }
+    return old;
+#else
+    return context->make_exception("Tracing is not built in");
+#endif
+}
+
+// {trace-print} writes out and empties the trace ring
+static TokenPtr builtin_trace_print(TokenPtr list, ContextPtr context)
+{
+#if LISP_TRACE
+    lisp_trace.print(stdout);
+    lisp_trace.clear();
+    return Token::bool_true;
+#else
+    return context->make_exception("Tracing is not built in");
+#endif
+}
+
+// {if cond then else} evaluates then if cond is true, otherwise else
+static TokenPtr builtin_if(TokenPtr list, ContextPtr context)
+{
+    if (!list) return 0;
+    TokenPtr cond = context->interp->evaluate_item(list, context);
+    if (cond && cond->type == Token::EXCEPTION) return cond;
+    TokenPtr branch = list->next;
+    if (!Token::bool_val(cond) && branch) branch = branch->next;
+    return context->interp->tail(branch, context);
+}
+
+// Evaluate each item of a loop body, stopping at an exception
+static TokenPtr loop_body(TokenPtr body, ContextPtr context)
+{
+    for (; body; body = body->next) {
+        TokenPtr r = context->interp->evaluate_item(body, context);
+        if (r && r->type == Token::EXCEPTION) return r;
+    }
+    return 0;
+}
+
+// {while cond body...} evaluates body for as long as cond is true
+static TokenPtr builtin_while(TokenPtr list, ContextPtr context)
+{
+    if (!list) return 0;
+    LispInterpreter *interp = context->interp;
+    for (;;) {
+        TokenPtr cond = interp->evaluate_item(list, context);
+        if (cond && cond->type == Token::EXCEPTION) return cond;
+        if (!Token::bool_val(cond)) return 0;
+        TokenPtr r = loop_body(list->next, context);
+        if (r) return r;
+    }
+}
+
+// Set var to start, start+step, ... for as long as it's short of end,
+// evaluating body each time. Counts in ints unless any of the three is a
+// float.
+static TokenPtr loop_range(TokenPtr var, TokenPtr start, TokenPtr end, TokenPtr step, TokenPtr body, ContextPtr context)
+{
+    if (!var || var->type != Token::SYM) {
+        return context->make_exception("Loop needs a variable name: " + Token::inspect(var));
+    }
+    SymbolPtr name = var->sym;
+    ContextPtr owner = context->get_owner(name);
+    if (!owner) return context->make_exception("No context for loop variable: " + Token::inspect(var));
+    
+    start = Token::as_number(start);
+    end = Token::as_number(end);
+    step = Token::as_number(step);
+    if (Token::float_val(step) == 0) {
+        return context->make_exception("Loop step can't be 0");
+    }
+    if (start->type == Token::INT && end->type == Token::INT && step->type == Token::INT) {
+        // The sum is done wide so a step past INT_MAX just ends the loop
+        int to = end->ival, by = step->ival;
+        for (int i=start->ival; by > 0 ? i < to : i > to; ) {
+            owner->set(name, Token::make_int(i));
+            TokenPtr r = loop_body(body, context);
+            if (r) return r;
+            int64_t next = (int64_t)i + by;
+            i = (by > 0 ? next >= to : next <= to) ? to : (int)next;
+        }
+    } else {
+        float to = Token::float_val(end), by = Token::float_val(step);
+        for (float f=Token::float_val(start); by > 0 ? f < to : f > to; f += by) {
+            owner->set(name, Token::make_float(f));
+            TokenPtr r = loop_body(body, context);
+            if (r) return r;
+        }
+    }
+    return 0;
+}
+
+// {dotimes {var count} body...} evaluates body with var set to 0, 1, ...
+// count-1
+static TokenPtr builtin_dotimes(TokenPtr list, ContextPtr context)
+{
+    if (!list || list->type != Token::LIST || !list->list) {
+        return context->make_exception("dotimes needs {var count}: " + Token::inspect(list));
+    }
+    LispInterpreter *interp = context->interp;
+    TokenPtr var = list->list;
+    TokenPtr count = interp->evaluate_item(var->next, context);
+    return loop_range(var, Token::zero, count, Token::one, list->next, context);
+}
+
+// {for {var start end step} body...} evaluates body with var counting from
+// start up to, but not including, end. A negative step counts down instead.
+// step defaults to 1, and can't be 0.
+static TokenPtr builtin_for(TokenPtr list, ContextPtr context)
+{
+    if (!list || list->type != Token::LIST || !list->list || !list->list->next || !list->list->next->next) {
+        return context->make_exception("for needs {var start end step}: " + Token::inspect(list));
+    }
+    LispInterpreter *interp = context->interp;
+    TokenPtr var = list->list;
+    TokenPtr start = interp->evaluate_item(var->next, context);
+    TokenPtr end = interp->evaluate_item(var->next->next, context);
+    TokenPtr step = interp->evaluate_item(var->next->next->next, context);
+    return loop_range(var, start, end, step ? step : Token::one, list->next, context);
+}
+
+// {vm on} chooses between compiled code and the tree-walker for calls to
+// user functions. Returns the old setting.
+static TokenPtr builtin_vm(TokenPtr list, ContextPtr context)
+{
+    LispInterpreter *interp = context->interp;
+    TokenPtr old = interp->use_vm ? Token::bool_true : Token::bool_false;
+    if (list) interp->use_vm = Token::bool_val(interp->evaluate_item(list, context));
+    return old;
+}
+
+// {fold on} chooses whether code parsed from now on has its constant
+// expressions worked out up front. Returns the old setting.
+static TokenPtr builtin_fold(TokenPtr list, ContextPtr context)
+{
+    LispInterpreter *interp = context->interp;
+    TokenPtr old = interp->use_folding ? Token::bool_true : Token::bool_false;
+    if (list) interp->use_folding = Token::bool_val(interp->evaluate_item(list, context));
+    return old;
+}
+
+// {mem} prints the node pool statistics and the most stack used
+static TokenPtr builtin_mem(TokenPtr list, ContextPtr context)
+{
+    LispInterpreter *interp = context->interp;
+    LispInterpreter::print_pools();
+    printf("stack    %6u bytes used at most, limit %u\n", (unsigned)interp->stack_high,
+        (unsigned)interp->stack_limit);
+    return Token::bool_true;
+}
+
 static TokenPtr builtin_set_class(TokenPtr item, ContextPtr caller)
 {
     if (item->type != Token::SYM) return 0; // exception
@@ -582,10 +787,20 @@ void LispInterpreter::loadOperators()
     
     addOperator("cat", builtin_cat, 0);
     addOperator("func", builtin_defun);
+    defun_oper = builtin_defun;
     addOperator("set", builtin_set);
     addOperator("set@", builtin_set_obj);
     addOperator("set@@", builtin_set_class);
     addOperator("class", builtin_defclass);
+    addOperator("trace", builtin_trace);
+    addOperator("trace-print", builtin_trace_print);
+    addOperator("mem", builtin_mem);
+    addOperator("if", builtin_if);
+    addOperator("while", builtin_while);
+    addOperator("dotimes", builtin_dotimes);
+    addOperator("for", builtin_for);
+    addOperator("vm", builtin_vm);
+    addOperator("fold", builtin_fold);
 
     addOperator("identity", builtin_identity, 0, Token::UNARY);
     addOperator("int", builtin_int, 0, Token::UNARY);
@@ -594,6 +809,32 @@ void LispInterpreter::loadOperators()
     addOperator("round", builtin_round, 0, Token::UNARY);
     addOperator("str", builtin_str, 0, Token::UNARY);
     
+    // Operators the compiler turns into VM instructions
+    addCompiledOper(builtin_add, CompiledOper::FOLD, add_two, Token::zero);
+    addCompiledOper(builtin_mul, CompiledOper::FOLD, mul_two, Token::one);
+    addCompiledOper(builtin_cat, CompiledOper::FOLD, cat_two, empty_string);
+    addCompiledOper(builtin_and_bitwise, CompiledOper::FOLD, and_two_bitwise, Token::negone);
+    addCompiledOper(builtin_or_bitwise, CompiledOper::FOLD, or_two_bitwise, Token::zero);
+    addCompiledOper(builtin_xor_bitwise, CompiledOper::FOLD, xor_two_bitwise, Token::zero);
+    addCompiledOper(builtin_and_bool, CompiledOper::FOLD, and_two_bool, Token::bool_true);
+    addCompiledOper(builtin_or_bool, CompiledOper::FOLD, or_two_bool, Token::bool_false);
+    addCompiledOper(builtin_sub, CompiledOper::FOLD_TWO, sub_two);
+    addCompiledOper(builtin_div, CompiledOper::FOLD_TWO, div_two);
+    addCompiledOper(builtin_mod, CompiledOper::FOLD_TWO, mod_two);
+    addCompiledOper(builtin_pow, CompiledOper::FOLD_TWO, pow_two);
+    addCompiledOper(builtin_eq, CompiledOper::FOLD_TWO, eq_two);
+    addCompiledOper(builtin_ne, CompiledOper::FOLD_TWO, ne_two);
+    addCompiledOper(builtin_lt, CompiledOper::FOLD_TWO, lt_two);
+    addCompiledOper(builtin_gt, CompiledOper::FOLD_TWO, gt_two);
+    addCompiledOper(builtin_le, CompiledOper::FOLD_TWO, le_two);
+    addCompiledOper(builtin_ge, CompiledOper::FOLD_TWO, ge_two);
+    addCompiledOper(builtin_identity, CompiledOper::BODY);
+    addCompiledOper(builtin_if, CompiledOper::IF);
+    addCompiledOper(builtin_set, CompiledOper::SET);
+    addCompiledOper(builtin_while, CompiledOper::WHILE);
+    addCompiledOper(builtin_dotimes, CompiledOper::DOTIMES);
+    addCompiledOper(builtin_for, CompiledOper::FOR);
+    
     // int, floor, ceil, round, float, bool, bitwise operators, bitwise not
     // Adding to item list requires duplication
     // Lists are immutable
@@ -74,7 +74,7 @@ std::ostream& LispInterpreter::print_item(std::ostream& os, TokenPtr t, ContextP
     case Token::EXCEPTION:
         if (t->sym) {
             Token::print_string(os, t->sym->p, t->sym->len);
-            std::cout << ", ";
+            os << ", ";
         }
         os << "exception(" << t->context->get_full_path(0) << ")";
         break;
@@ -295,7 +295,7 @@ TokenPtr Token::parse_number(Parsing& p)
             } else break;
         }
         if (len > 0) {
-            t = std::make_shared<Token>();
+            t = make_ref<Token>();
             t->type = Token::INT;
             t->ival = parse_octal(p.get_mark() + 1, p.mark_len());
             return t;
@@ -313,7 +313,7 @@ TokenPtr Token::parse_number(Parsing& p)
             } else break;
         }
         if (len > 0) {
-            t = std::make_shared<Token>();
+            t = make_ref<Token>();
             t->type = Token::INT;
             t->ival = parse_hex(p.get_mark() + 2, p.mark_len());
             return t;
@@ -337,7 +337,7 @@ TokenPtr Token::parse_number(Parsing& p)
             } else break;
         }
         if (len > 0) {
-            t = std::make_shared<Token>();
+            t = make_ref<Token>();
             if (is_float) {
                 t->type = Token::FLOAT;
                 t->fval = parse_float(p.get_mark(), p.mark_len());
@@ -378,6 +378,7 @@ SymbolPtr LispInterpreter::parse_symbol(const char *str, int len)
 TokenPtr LispInterpreter::parse_token(Parsing& p)
 {
     char *s;
+    char buf[64];
     bool quote = false;
     char c;
     int len;
@@ -414,20 +415,25 @@ TokenPtr LispInterpreter::parse_token(Parsing& p)
             }
         }
         
-        t = std::make_shared<Token>();
+        t = make_ref<Token>();
         t->type = Token::STR;
         len = p.mark_len();
-        s = new char[len];
-        len = Token::parse_string(p.get_mark(), len, s);
-        t->sym = interns.find(s, len);
-        delete [] s;
+        if (len <= (int)sizeof(buf)) {
+            len = Token::parse_string(p.get_mark(), len, buf);
+            t->sym = interns.find(buf, len);
+        } else {
+            s = new char[len];
+            len = Token::parse_string(p.get_mark(), len, s);
+            t->sym = interns.find(s, len);
+            delete [] s;
+        }
         t->quote = quote;
         p.skip();
         return t;
         
     case '{':
         p.skip();
-        t = std::make_shared<Token>();
+        t = make_ref<Token>();
         t->type = Token::LIST;
         t->list = parse_string(p);
         t->quote = quote;
@@ -435,7 +441,7 @@ TokenPtr LispInterpreter::parse_token(Parsing& p)
         
     case '(':
         p.skip();
-        t = std::make_shared<Token>();
+        t = make_ref<Token>();
         t->type = Token::INFIX;
         t->list = parse_string(p);
         t->quote = quote;
@@ -461,7 +467,7 @@ TokenPtr LispInterpreter::parse_token(Parsing& p)
             }
         }
         
-        t = std::make_shared<Token>();
+        t = make_ref<Token>();
         t->type = Token::SYM;
         t->quote = quote;
         t->sym = parse_symbol(p.get_mark(), p.mark_len());
@@ -477,7 +483,7 @@ TokenPtr LispInterpreter::parse_token(Parsing& p)
         }
     }
     
-    t = std::make_shared<Token>();
+    t = make_ref<Token>();
     t->type = Token::SYM;
     t->quote = quote;
     t->sym = parse_symbol(p.get_mark(), p.mark_len());
@@ -0,0 +1,37 @@
+#include "lisp_trace.hpp"
+
+#if LISP_TRACE
+
+LispTrace lisp_trace;
+
+int LispTrace::overflow(int c)
+{
+    if (c != traits_type::eof()) {
+        ring[next & (RING_SIZE-1)] = c;
+        next++;
+    }
+    return c;
+}
+
+std::streamsize LispTrace::xsputn(const char *s, std::streamsize n)
+{
+    for (std::streamsize i=0; i<n; i++) {
+        ring[next & (RING_SIZE-1)] = s[i];
+        next++;
+    }
+    return n;
+}
+
+void LispTrace::print(FILE *f)
+{
+    uint32_t i = next < (uint32_t)RING_SIZE ? 0 : next - RING_SIZE;
+    if (i) {
+        // The oldest line has probably lost its start
+        while (i != next && ring[i & (RING_SIZE-1)] != '\n') i++;
+        if (i != next) i++;
+    }
+    for (; i!=next; i++) fputc(ring[i & (RING_SIZE-1)], f);
+    fflush(f);
+}
+
+#endif
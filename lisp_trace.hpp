@@ -0,0 +1,76 @@
+#ifndef INCLUDED_LISP_TRACE_HPP
+#define INCLUDED_LISP_TRACE_HPP
+
+// Tracing for the Lisp interpreter. Build with LISP_TRACE=1 to get it;
+// otherwise LTRACE expands to nothing and its message isn't even compiled.
+//
+// Every message has a category and a level. It's kept only if its category
+// is set in lisp_trace.categories and its level is at or below
+// lisp_trace.level. Both can be changed at runtime, from Lisp with the
+// trace operator. Kept messages are formatted into a text ring that
+// overwrites the oldest output instead of going to stdio, so tracing never
+// waits on the UART; print() shows what the ring holds.
+
+#ifndef LISP_TRACE
+#define LISP_TRACE 0
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum LispTraceCategory : uint8_t {
+    TR_EVAL = 1,        // evaluate_item
+    TR_CALL = 2,        // function and operator calls and definitions
+    TR_VARS = 4,        // variable lookups and assignments
+    TR_INFIX = 8,       // infix to prefix transformation
+    TR_ALL = 0xff
+};
+
+enum LispTraceLevel : uint8_t {
+    TL_ERROR = 0,
+    TL_INFO,
+    TL_DEBUG
+};
+
+#if LISP_TRACE
+
+#include <ostream>
+#include <streambuf>
+
+struct LispTrace : public std::streambuf {
+    static constexpr int RING_SIZE = 4096;
+    
+    char ring[RING_SIZE];
+    uint32_t next = 0;      // free-running count of characters written
+    uint8_t categories = TR_ALL;
+    uint8_t level = TL_ERROR;
+    std::ostream os{this};
+    
+    bool enabled(uint8_t category, uint8_t lev) const {
+        return (categories & category) && lev <= level;
+    }
+    void end() { sputc('\n'); }
+    void print(FILE *f);    // oldest first, starting at a whole line
+    void clear() { next = 0; }
+    
+protected:
+    int overflow(int c) override;
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+};
+
+extern LispTrace lisp_trace;
+
+#define LTRACE(category, level, msg) do { \
+        if (lisp_trace.enabled((category), (level))) { \
+            lisp_trace.os << msg; \
+            lisp_trace.end(); \
+        } \
+    } while (0)
+
+#else
+
+#define LTRACE(category, level, msg) do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,733 @@
+#include "lisp.hpp"
+
+// Compiler from user function bodies to bytecode, and the stack VM that
+// runs it.
+//
+// A function is compiled the first time it's called, as long as its body
+// only uses forms with a compiled equivalent: constants, quoted items,
+// undotted variables, calls, and the built-in operators registered with
+// addCompiledOper. Anything else marks the code as not ok and the function
+// keeps running on the tree-walker, which stays the reference for what
+// compiled code has to do.
+//
+// Parameters, the variables a body sets and loop variables are locals,
+// resolved to slots at compile time. As with a Context, a slot holding nothing falls back to
+// looking the name up from the function's owner. Calls between compiled
+// functions push a VM frame rather than recursing on the C stack, and one
+// in tail position replaces the caller's frame.
+//
+// The stack and locals hold Values, so numbers and bools stay unboxed
+// while compiled code works on them. A token is only made for one when it
+// leaves the VM, by being returned from it or passed to a tree-walked
+// function.
+
+enum Opcode : uint8_t {
+    OP_NIL,         // push null
+    OP_CONST,       // u16 constant
+    OP_LOAD,        // u8 slot, u16 name: push local, or look name up if unset
+    OP_NAME,        // u16 name: push name looked up from the owner
+    OP_STORE,       // u8 slot: set local to the top of the stack, keeping it
+    OP_POP,
+    OP_FOLD,        // u8 compiled operator, u8 count: replace values by result
+    OP_JUMP,        // u16 target
+    OP_JUMP_FALSE,  // u16 target: pop, and jump if false
+    OP_JUMP_EXC,    // u16 target: jump if the top of the stack is an exception
+    OP_CALL,        // u16 name, u8 count: call function with count values
+    OP_TAIL_CALL,   // as OP_CALL, returning what the call does
+    OP_RETURN,
+    OP_FOR_INIT,    // u8 slot: make the counter, end and step there numbers,
+                    // pushing null, or an exception if the step is 0
+    OP_FOR_NEXT     // u8 slot, u8 var, u16 exit: set var to the counter and
+                    // advance it, or jump to exit if it has reached end
+};
+
+struct Compiler {
+    typedef LispInterpreter::CompiledOper CompiledOper;
+
+    LispInterpreter *interp;
+    ContextPtr owner;
+    Code *code;
+    std::vector<int> locals;    // Symbol::index of each slot
+    bool ok = true;
+
+    Compiler(LispInterpreter *i, ContextPtr o, Code *c) : interp(i), owner(o), code(c) {}
+
+    int local(const SymbolPtr& s) {
+        for (int i=0; i<(int)locals.size(); i++) {
+            if (locals[i] == s->index) return i;
+        }
+        return -1;
+    }
+
+    int add_local(const SymbolPtr& s) {
+        int slot = local(s);
+        if (slot >= 0) return slot;
+        if (locals.size() >= 255) {
+            ok = false;
+            return 0;
+        }
+        locals.push_back(s->index);
+        return locals.size() - 1;
+    }
+
+    // n slots no name refers to
+    int add_hidden(int n) {
+        if (locals.size() + n > 255) {
+            ok = false;
+            return 0;
+        }
+        locals.resize(locals.size() + n, -1);
+        return locals.size() - n;
+    }
+
+    // The {var start end step} or {var count} that starts a counted loop
+    TokenPtr loop_var(TokenPtr spec, int form) {
+        if (!spec || spec->type != Token::LIST || spec->quote) {
+            ok = false;
+            return 0;
+        }
+        TokenPtr var = spec->list;
+        int need = form == CompiledOper::FOR ? 2 : 1;
+        TokenPtr t = var ? var->next : 0;
+        for (int i=0; i<need; i++, t = t ? t->next : 0) {
+            if (!t) var = 0;
+        }
+        if (!var || var->type != Token::SYM || var->quote || var->sym->next) {
+            ok = false;
+            return 0;
+        }
+        return var;
+    }
+
+    void emit(uint8_t b) {
+        code->ops.push_back(b);
+    }
+
+    void emit16(int v) {
+        emit(v & 0xff);
+        emit(v >> 8);
+    }
+
+    void patch16(int at, int v) {
+        code->ops[at] = v & 0xff;
+        code->ops[at+1] = v >> 8;
+    }
+
+    void emit_const(TokenPtr t) {
+        if (code->consts.size() >= 0xffff) ok = false;
+        emit(OP_CONST);
+        emit16(code->consts.size());
+        code->consts.push_back(t);
+    }
+
+    int name(TokenPtr t) {
+        if (code->consts.size() >= 0xffff) ok = false;
+        code->consts.push_back(t);
+        return code->consts.size() - 1;
+    }
+
+    // What the head of a call is, as far as can be told now. Returns the
+    // compiled operator, or null for a call to a user function, and clears
+    // ok if the call can't be compiled. Dotted names are only compiled when
+    // they name an operator, like gfx.line.
+    const CompiledOper *resolve(TokenPtr head) {
+        if (head->type != Token::SYM || local(head->sym) >= 0) {
+            ok = false;
+            return 0;
+        }
+        TokenPtr f = owner->get(head->sym);
+        if (head->sym->next && (!f || f->type != Token::OPER)) {
+            ok = false;
+            return 0;
+        }
+        if (!f || f->type == Token::FUNC) return 0;
+        if (f->type == Token::OPER) {
+            for (const CompiledOper& op : interp->compiled_opers) {
+                if (op.oper == f->oper) return &op;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+
+    // Give every variable the body sets a slot before compiling, so reads
+    // that come first in the code still see them
+    void find_locals(TokenPtr item) {
+        for (; item && ok; item = item->next) {
+            if (item->type != Token::LIST || item->quote) continue;
+            TokenPtr l = item->list;
+            while (l && l->type == Token::LIST) {
+                find_locals(l);
+                l = l->next;
+            }
+            if (!l) continue;
+            const CompiledOper *op = resolve(l);
+            if (!ok) return;
+            TokenPtr args = l->next;
+            if (op && op->form == CompiledOper::SET) {
+                if (!args || args->type != Token::SYM || args->sym->next) {
+                    ok = false;
+                    return;
+                }
+                add_local(args->sym);
+                find_locals(args->next);
+            } else if (op && (op->form == CompiledOper::DOTIMES || op->form == CompiledOper::FOR)) {
+                TokenPtr var = loop_var(args, op->form);
+                if (!ok) return;
+                add_local(var->sym);
+                find_locals(var->next);
+                find_locals(args->next);
+            } else {
+                find_locals(args);
+            }
+        }
+    }
+
+    // tail is set when the value is what the function returns
+    void expr(TokenPtr item, bool tail = false) {
+        if (!item) {
+            emit(OP_NIL);
+        } else if (item->quote) {
+            emit_const(item);
+        } else if (item->type == Token::LIST) {
+            if (item->folded) emit_const(TokenPtr(item->folded));
+            else list(item->list, tail);
+        } else if (item->type == Token::SYM) {
+            if (item->sym->next) {
+                ok = false;
+                return;
+            }
+            int slot = local(item->sym);
+            if (slot >= 0) {
+                emit(OP_LOAD);
+                emit(slot);
+            } else {
+                emit(OP_NAME);
+            }
+            emit16(name(item));
+        } else {
+            emit_const(item);
+        }
+    }
+
+    // A loop body, leaving nothing, but jumping to the loop's end with an
+    // exception if an item gives one
+    void loop_body(TokenPtr item, std::vector<int>& exits) {
+        for (; item; item = item->next) {
+            expr(item);
+            emit(OP_JUMP_EXC);
+            exits.push_back(code->ops.size());
+            emit16(0);
+            emit(OP_POP);
+        }
+    }
+
+    // Each item in turn, giving the last, as evaluate_list does
+    void body(TokenPtr item, bool tail = false) {
+        if (!item) {
+            emit(OP_NIL);
+            return;
+        }
+        for (;;) {
+            expr(item, tail && !item->next);
+            item = item->next;
+            if (!item) break;
+            emit(OP_POP);
+        }
+    }
+
+    // The contents of an unquoted list, as evaluate_item does them
+    void list(TokenPtr l, bool tail) {
+        bool any = false;
+        while (l && l->type == Token::LIST) {
+            if (any) emit(OP_POP);
+            expr(l, tail && !l->next);
+            any = true;
+            l = l->next;
+        }
+        if (!l) {
+            if (!any) emit(OP_NIL);
+            return;
+        }
+        if (any) emit(OP_POP);
+
+        const CompiledOper *op = resolve(l);
+        if (!ok) return;
+        TokenPtr args = l->next;
+        int n = 0;
+
+        if (!op) {
+            for (TokenPtr a = args; a; a = a->next) {
+                expr(a);
+                n++;
+            }
+            if (n > 255) ok = false;
+            emit(tail ? OP_TAIL_CALL : OP_CALL);
+            emit16(name(l));
+            emit(n);
+            return;
+        }
+
+        switch (op->form) {
+        case CompiledOper::FOLD:
+        case CompiledOper::FOLD_TWO:
+        case CompiledOper::NATIVE:
+            for (TokenPtr a = args; a; a = a->next) {
+                if (op->form == CompiledOper::FOLD_TWO && n == 2) break;
+                expr(a);
+                n++;
+            }
+            if (n > 255) ok = false;
+            emit(OP_FOLD);
+            emit(op - &interp->compiled_opers[0]);
+            emit(n);
+            break;
+
+        case CompiledOper::BODY:
+            body(args, tail);
+            break;
+
+        case CompiledOper::IF:
+            if (!args) {
+                emit(OP_NIL);
+            } else {
+                expr(args);
+                emit(OP_JUMP_FALSE);
+                int to_else = code->ops.size();
+                emit16(0);
+                TokenPtr then = args->next;
+                expr(then, tail);
+                emit(OP_JUMP);
+                int to_end = code->ops.size();
+                emit16(0);
+                patch16(to_else, code->ops.size());
+                expr(then ? then->next : 0, tail);
+                patch16(to_end, code->ops.size());
+            }
+            break;
+
+        case CompiledOper::SET:
+            body(args->next);
+            emit(OP_STORE);
+            emit(local(args->sym));
+            break;
+
+        // Loops give null, or the first exception from their body
+        case CompiledOper::WHILE: {
+            if (!args) {
+                emit(OP_NIL);
+                break;
+            }
+            std::vector<int> exits;
+            int top = code->ops.size();
+            expr(args);
+            emit(OP_JUMP_EXC);
+            exits.push_back(code->ops.size());
+            emit16(0);
+            emit(OP_JUMP_FALSE);
+            int to_done = code->ops.size();
+            emit16(0);
+            loop_body(args->next, exits);
+            emit(OP_JUMP);
+            emit16(top);
+            patch16(to_done, code->ops.size());
+            emit(OP_NIL);
+            for (int at : exits) patch16(at, code->ops.size());
+            break;
+        }
+
+        case CompiledOper::DOTIMES:
+        case CompiledOper::FOR: {
+            TokenPtr var = loop_var(args, op->form);
+            if (!ok) return;
+            int slot = add_hidden(3);
+            TokenPtr t = var->next;
+            if (op->form == CompiledOper::DOTIMES) {
+                emit_const(Token::zero);
+            } else {
+                expr(t);
+                t = t->next;
+            }
+            emit(OP_STORE);
+            emit(slot);
+            emit(OP_POP);
+            expr(t);
+            emit(OP_STORE);
+            emit(slot + 1);
+            emit(OP_POP);
+            if (op->form == CompiledOper::DOTIMES) {
+                emit_const(Token::one);
+            } else {
+                expr(t->next);
+            }
+            emit(OP_STORE);
+            emit(slot + 2);
+            emit(OP_POP);
+            std::vector<int> exits;
+            emit(OP_FOR_INIT);
+            emit(slot);
+            emit(OP_JUMP_EXC);
+            exits.push_back(code->ops.size());
+            emit16(0);
+            emit(OP_POP);
+
+            int top = code->ops.size();
+            emit(OP_FOR_NEXT);
+            emit(slot);
+            emit(local(var->sym));
+            int to_done = code->ops.size();
+            emit16(0);
+            loop_body(args->next, exits);
+            emit(OP_JUMP);
+            emit16(top);
+            patch16(to_done, code->ops.size());
+            emit(OP_NIL);
+            for (int at : exits) patch16(at, code->ops.size());
+            break;
+        }
+        }
+    }
+
+    void function(TokenPtr params) {
+        TokenPtr b = params->next;
+        if (!b) {
+            emit(OP_NIL);
+            emit(OP_RETURN);
+            return;
+        }
+        if (params->type != Token::LIST) {
+            ok = false;
+            return;
+        }
+        for (TokenPtr p = params->list; p; p = p->next) {
+            // A quoted last parameter takes the rest of the arguments
+            if (p->type != Token::SYM || p->quote || p->sym->next || local(p->sym) >= 0) {
+                ok = false;
+                return;
+            }
+            add_local(p->sym);
+        }
+        code->nparams = locals.size();
+        find_locals(b);
+        body(b, true);
+        emit(OP_RETURN);
+        // Loops add hidden slots as they're compiled
+        code->nlocals = locals.size();
+        if (code->ops.size() > 0xffff) ok = false;
+    }
+};
+
+Code *LispInterpreter::get_code(TokenPtr func, ContextPtr owner)
+{
+    if (func->code) return func->code;
+
+    // The token holds its own count on its code
+    Ref<Code> ref = make_ref<Code>();
+    Code *code = ref.get();
+    code->refs++;
+    func->code = code;
+
+    Compiler c(this, owner, code);
+    c.function(func->list);
+    code->ok = c.ok;
+    if (!c.ok) {
+        code->ops.clear();
+        code->consts.clear();
+    }
+    LTRACE(TR_CALL, TL_INFO, "Compiled " << func->sym << (c.ok ? "" : " failed, using tree-walker")
+        << ": " << code->ops.size() << " bytes, " << int(code->nlocals) << " locals");
+    return code;
+}
+
+Value LispInterpreter::vm_fold(const CompiledOper& op, int first, int n)
+{
+    // An exception among the values is passed on, as the operators do
+    if (op.form != CompiledOper::BODY) {
+        for (int i=0; i<n; i++) {
+            if (vm_stack[first+i].is_exception()) return vm_stack[first+i];
+        }
+    }
+    Value r;
+    switch (op.form) {
+    case CompiledOper::FOLD:
+        r = op.initial;
+        for (int i=0; i<n; i++) r = op.combine(r, vm_stack[first+i], this);
+        break;
+    case CompiledOper::FOLD_TWO:
+        r = op.combine(n > 0 ? vm_stack[first] : Value(), n > 1 ? vm_stack[first+1] : Value(), this);
+        break;
+    case CompiledOper::BODY:
+        if (n) r = vm_stack[first+n-1];
+        break;
+    case CompiledOper::NATIVE:
+        r = op.native(&vm_stack[first], n, this);
+        break;
+    }
+    return r;
+}
+
+// Call a tree-walked function with values already evaluated by the VM
+TokenPtr LispInterpreter::call_with_values(SymbolPtr name, TokenPtr params, int first, int n, ContextPtr owner)
+{
+    TokenPtr body = params->next;
+    if (!body) return 0;
+    if (params->type != Token::LIST) {
+        LTRACE(TR_CALL, TL_ERROR, "Function doesn't start with list of args");
+        return 0;
+    }
+
+    params = params->list;
+    int nparams = 0;
+    for (TokenPtr p = params; p; p = p->next) nparams++;
+    owner = owner->make_child_function(name, nparams);
+    for (int i=0; i<n && params; i++) {
+        if (params->quote) {
+            // Final parameter gets a list of the rest of the values
+            TokenPtr head, tail;
+            for (; i<n; i++) {
+                const Value& v = vm_stack[first+i];
+                TokenPtr t = v.is_inline() ? v.token() : Token::duplicate(v.ref);
+                if (tail) tail->next = t; else head = t;
+                tail = t;
+            }
+            owner->set(params->sym, Token::as_list(head));
+            break;
+        }
+        owner->set(params->sym, vm_stack[first+i].token());
+        params = params->next;
+    }
+    return evaluate_list(body, owner);
+}
+
+TokenPtr LispInterpreter::vm_call(SymbolPtr name, TokenPtr func, Code *code, TokenPtr args, ContextPtr owner, ContextPtr caller)
+{
+    LTRACE(TR_CALL, TL_INFO, "Calling compiled func " << name);
+
+    if (vm_frames.size() >= max_frames) {
+        return caller->make_exception("Recursion too deep: " + std::string(name->as_stringview()));
+    }
+
+    // Arguments are evaluated in the caller, as many as there are
+    // parameters. Evaluating one may run the VM, which leaves the stack as
+    // it found it.
+    int base = vm_stack.size();
+    int n = 0;
+    for (; args && n < code->nparams; n++, args = args->next) {
+        vm_stack.push_back(evaluate_item(args, caller));
+    }
+    vm_stack.resize(base + code->nlocals);
+
+    size_t depth = vm_frames.size();
+    vm_frames.push_back({code, 0, base, owner, func});
+    return vm_run(depth).token();
+}
+
+// A name that isn't a local. The global context has no parent, so when
+// that's the owner its dense slot for the symbol is the whole answer.
+static inline TokenPtr lookup(const ContextPtr& owner, const SymbolPtr& s)
+{
+    if (owner->vars.dense) return owner->vars.get(s);
+    return owner->get(s);
+}
+
+// Run until the frame above depth returns
+Value LispInterpreter::vm_run(size_t depth)
+{
+    Frame *f = &vm_frames.back();
+    const uint8_t *ops = f->code->ops.data();
+    const TokenPtr *consts = f->code->consts.data();
+    int pc = f->pc;
+
+    #define U16(at) (ops[at] | (ops[(at)+1] << 8))
+
+    for (;;) {
+        switch (ops[pc]) {
+        case OP_NIL:
+            vm_stack.emplace_back();
+            pc++;
+            break;
+
+        case OP_CONST:
+            vm_stack.emplace_back(consts[U16(pc+1)]);
+            pc += 3;
+            break;
+
+        case OP_LOAD: {
+            const Value& v = vm_stack[f->base + ops[pc+1]];
+            if (!v.is_nil()) {
+                vm_stack.push_back(Value(v));
+            } else {
+                vm_stack.emplace_back(lookup(f->owner, consts[U16(pc+2)]->sym));
+            }
+            pc += 4;
+            break;
+        }
+
+        case OP_NAME:
+            vm_stack.emplace_back(lookup(f->owner, consts[U16(pc+1)]->sym));
+            pc += 3;
+            break;
+
+        case OP_STORE:
+            vm_stack[f->base + ops[pc+1]] = vm_stack.back();
+            pc += 2;
+            break;
+
+        case OP_POP:
+            vm_stack.pop_back();
+            pc++;
+            break;
+
+        case OP_FOLD: {
+            int n = ops[pc+2];
+            int first = vm_stack.size() - n;
+            Value r = vm_fold(compiled_opers[ops[pc+1]], first, n);
+            vm_stack.resize(first);
+            vm_stack.push_back(std::move(r));
+            pc += 3;
+            break;
+        }
+
+        case OP_JUMP:
+            pc = U16(pc+1);
+            break;
+
+        case OP_JUMP_FALSE: {
+            bool b = vm_stack.back().bool_val();
+            vm_stack.pop_back();
+            pc = b ? pc + 3 : U16(pc+1);
+            break;
+        }
+
+        case OP_JUMP_EXC:
+            pc = vm_stack.back().is_exception() ? U16(pc+1) : pc + 3;
+            break;
+
+        case OP_FOR_INIT: {
+            // As loop_range: ints if all three are, otherwise floats. No
+            // step counts as 1.
+            Value *v = &vm_stack[f->base + ops[pc+1]];
+            if (v[2].is_nil()) v[2] = Value::make_int(1);
+            for (int i=0; i<3; i++) v[i] = v[i].as_number();
+            if (v[0].type != Token::INT || v[1].type != Token::INT || v[2].type != Token::INT) {
+                for (int i=0; i<3; i++) v[i] = Value::make_float(v[i].float_val());
+            }
+            if (v[2].float_val() == 0) {
+                vm_stack.push_back(f->owner->make_exception("Loop step can't be 0"));
+            } else {
+                vm_stack.emplace_back();
+            }
+            pc += 2;
+            break;
+        }
+
+        case OP_FOR_NEXT: {
+            Value *v = &vm_stack[f->base + ops[pc+1]];
+            bool more;
+            if (v[0].type == Token::INT) {
+                more = v[2].ival > 0 ? v[0].ival < v[1].ival : v[0].ival > v[1].ival;
+            } else {
+                more = v[2].fval > 0 ? v[0].fval < v[1].fval : v[0].fval > v[1].fval;
+            }
+            if (!more) {
+                pc = U16(pc+3);
+                break;
+            }
+            vm_stack[f->base + ops[pc+2]] = v[0];
+            if (v[0].type == Token::INT) {
+                // As loop_range, stopping at end rather than overflowing
+                int64_t next = (int64_t)v[0].ival + v[2].ival;
+                bool done = v[2].ival > 0 ? next >= v[1].ival : next <= v[1].ival;
+                v[0].ival = done ? v[1].ival : (int32_t)next;
+            } else {
+                v[0].fval += v[2].fval;
+            }
+            pc += 5;
+            break;
+        }
+
+        case OP_CALL:
+        case OP_TAIL_CALL: {
+            bool tail = ops[pc] == OP_TAIL_CALL;
+            SymbolPtr name = consts[U16(pc+1)]->sym;
+            int n = ops[pc+3];
+            int first = vm_stack.size() - n;
+            pc += 4;
+
+            ContextPtr owner;
+            TokenPtr func = f->owner->get(name, owner);
+            Value r;
+            if (func && func->type == Token::FUNC) {
+                Code *code = use_vm ? get_code(func, owner) : 0;
+                if (code && code->ok && tail) {
+                    // Move the values down over this frame's locals and
+                    // run the callee in its place
+                    LTRACE(TR_CALL, TL_INFO, "Tail calling compiled func " << name);
+                    int keep = n < code->nparams ? n : code->nparams;
+                    for (int i=0; i<keep; i++) vm_stack[f->base + i] = std::move(vm_stack[first + i]);
+                    vm_stack.resize(f->base + keep);
+                    vm_stack.resize(f->base + code->nlocals);
+                    f->code = code;
+                    f->owner = owner;
+                    f->func = func;
+                    ops = code->ops.data();
+                    consts = code->consts.data();
+                    pc = 0;
+                    break;
+                }
+                if (code && code->ok && vm_frames.size() < max_frames) {
+                    LTRACE(TR_CALL, TL_INFO, "Calling compiled func " << name);
+                    vm_stack.resize(first + (n < code->nparams ? n : code->nparams));
+                    vm_stack.resize(first + code->nlocals);
+                    f->pc = pc;
+                    vm_frames.push_back({code, 0, first, owner, func});
+                    f = &vm_frames.back();
+                    ops = code->ops.data();
+                    consts = code->consts.data();
+                    pc = 0;
+                    break;
+                }
+                if (code && code->ok) {
+                    r = f->owner->make_exception("Recursion too deep: " + std::string(name->as_stringview()));
+                } else {
+                    r = call_with_values(name, func->list, first, n, owner);
+                    f = &vm_frames.back();
+                }
+            } else if (func && func->type == Token::OPER) {
+                bool found = false;
+                for (const CompiledOper& op : compiled_opers) {
+                    if (op.oper == func->oper && (op.form <= CompiledOper::BODY || op.form == CompiledOper::NATIVE)) {
+                        r = vm_fold(op, first, n);
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found) r = f->owner->make_exception("Operator can't be called from compiled code: " + std::string(name->as_stringview()));
+            } else {
+                r = f->owner->make_exception("Function name not found: " + std::string(name->as_stringview()));
+            }
+            if (r.is_exception()) r = f->owner->check_exception(r.ref);
+            vm_stack.resize(first);
+            vm_stack.push_back(std::move(r));
+            break;
+        }
+
+        case OP_RETURN: {
+            Value r = std::move(vm_stack.back());
+            vm_stack.resize(f->base);
+            vm_frames.pop_back();
+            if (vm_frames.size() == depth) return r;
+
+            f = &vm_frames.back();
+            if (r.is_exception()) r = f->owner->check_exception(r.ref);
+            vm_stack.push_back(std::move(r));
+            ops = f->code->ops.data();
+            consts = f->code->consts.data();
+            pc = f->pc;
+            break;
+        }
+        }
+    }
+
+    #undef U16
+}
@@ -14,12 +14,15 @@
 // #include "msc_app.hpp"
 #include "console_stdio.hpp"
 #include "lisp.hpp"
+#include "scheduler.hpp"
+#include "instrument.hpp"
 
 VGAVideo *video = 0;
 VGAGraphics *graphics = 0;
 VGATerm *term = 0;
 VGAConsole *console = 0;
 VGAMouse *mouse = 0;
+GfxQueue gfx_queue;
 extern HIDHost *usb_hid;
 // extern MSCHost *usb_msc;
 
@@ -70,34 +73,35 @@ void read_line(std::string& line)
     }
 }
 
-uint64_t last_print = 0;
-uint64_t last_task = 0;
-uint64_t max_delay[4] = {0};
+Scheduler *scheduler = 0;
 
-void all_core1_tasks()
+// Scheduler entries must be plain functions
+static void console_render_task() { console->render_task(); }
+
+static void report_task()
 {
-    uint64_t now = time_us_64();
-    if (last_task) {
-        uint64_t dif = now - last_task;
-        if (dif > max_delay[0]) max_delay[0] = dif;
+    scheduler->report();
+    scheduler->reset_stats();
+    instrument_report();
+    if (term) {
+        const GTerm::ScrollStats& ss = term->GetScrollStats();
+        printf("scrolled %lu, dropped %lu, rendered %lu, renumbers %lu\n",
+            ss.lines_scrolled, ss.lines_dropped, ss.lines_rendered, ss.renumbers);
     }
-    last_task = now;
-    if (now - last_print > 10000000) {
-        printf("delay %d, %d, %d, %d\n", (int)max_delay[0], (int)max_delay[1], (int)max_delay[2], (int)max_delay[3]);
-        last_print = now;
+    if (console) {
+        printf("draw queue high water %d, dropped %d, idle %d\n", (int)console->draw_queue.high_water,
+            (int)console->draw_queue.overflows, (int)console->idle_waits);
+        printf("gfx queue high water %d, dropped %d\n", (int)gfx_queue.high_water, (int)gfx_queue.overflows);
+        console->frame_render.print("frame");
+        console->frame_render.reset();
+        printf("rows deferred %u, frames incomplete %u\n", (unsigned)console->rows_deferred,
+            (unsigned)console->frames_incomplete);
+        const VGAConsole::RenderDecisions& rd = console->decisions;
+        printf("render idle %u, fits %u, forced %u, skipped %u, full %u, busy %u; parse %uns/byte, draw %uns/cell\n",
+            (unsigned)rd.idle, (unsigned)rd.fits, (unsigned)rd.forced, (unsigned)rd.skipped, (unsigned)rd.full,
+            (unsigned)rd.busy,
+            (unsigned)console->parse_ns_per_byte, (unsigned)console->render_ns_per_cell);
     }
-    
-    uint64_t t1 = time_us_64();
-    hid_app_task();
-    uint64_t t2 = time_us_64();
-    tuh_task();
-    uint64_t t3 = time_us_64();
-    console->console_task();
-    uint64_t t4 = time_us_64();
-    
-    if (t2 - t1 > max_delay[1]) max_delay[1] = t2 - t1;
-    if (t3 - t2 > max_delay[2]) max_delay[2] = t3 - t2;
-    if (t4 - t3 > max_delay[3]) max_delay[3] = t4 - t3;
 }
 
 // Entry point for second CPU
@@ -111,6 +115,8 @@ void core1_entry()
     term = new VGATerm(graphics);
     mouse = new VGAMouse(graphics);
     console = new VGAConsole(term, mouse);
+    console->set_gfx(&gfx_queue);
+    video->doorbell = &console->doorbell;
     init_stdio_vga();
 
     printf("Starting USB\n");
@@ -121,10 +127,12 @@ void core1_entry()
     //usb_hid->start(); // Obsolete
     tuh_init(BOARD_TUH_RHPORT);
     
-    
-    // XXX Make a console_task
-    // console->add_task(hid_app_task);
-    // console->add_task(tuh_task);
+    // Rendering races the beam, so it can run at any point in the frame
+    scheduler = new Scheduler(video);
+    scheduler->add_task("render", console_render_task, 0);
+    scheduler->add_task("tuh", tuh_task, 1);
+    scheduler->add_task("hid", hid_app_task, 2);
+    scheduler->add_task("report", report_task, 9, Scheduler::ANYTIME, 10000000);
     
     draw_test_pattern();
     
@@ -133,17 +141,29 @@ void core1_entry()
         // XXX Start disk I/O operations from here
         // ...
         
-        all_core1_tasks();
+        scheduler->run_once();
+        
+        // Nothing to draw: sleep until the other core queues an update,
+        // the next frame starts or a USB interrupt needs servicing
+        console->wait_for_work();
     }
 }
 
+// The Lisp interpreter's stack. The SDK's own stack for the second core
+// is only 2K in the 4K scratch bank, too small for much recursion, so it
+// gets this one instead. The interpreter raises an exception rather than
+// go past its end; {mem} shows how much has been used.
+static uint32_t lisp_stack[16 * 1024 / sizeof(uint32_t)];
+
 void core0_entry()
 {
     video = new VGAVideo(hblank_isr);
     video->start();
     
     LispInterpreter li;
-    
+    li.stack_limit = sizeof(lisp_stack) - LISP_STACK_RESERVE;
+    gfx_queue.frame = &video->frame;
+    li.addGraphics(&gfx_queue);
                 
     printf("Entering main loop on core 0\n");
     while (1) {
@@ -190,7 +210,7 @@ int main()
     // usb_hid->start(); 
 
     printf("\n\nStarting VGA\n");
-    multicore_launch_core1(core0_entry);
+    multicore_launch_core1_with_stack(core0_entry, lisp_stack, sizeof(lisp_stack));
     core1_entry();
 }
 
@@ -0,0 +1,158 @@
+#ifndef INCLUDED_POOL_HPP
+#define INCLUDED_POOL_HPP
+
+// Fixed-size object pools with intrusive reference counting, used for the
+// Lisp interpreter's tokens, contexts and symbols in place of shared_ptr.
+//
+// A Pool<T> carves objects out of slabs of SLAB_SIZE and keeps freed ones
+// on a free list. Slabs are never given back, so the heap only sees one
+// allocation per SLAB_SIZE objects and doesn't fragment. A pooled class
+// derives from RefCounted and has a static Pool named pool; make_ref()
+// constructs one and Ref<T> holds it. Counts are plain ints: the
+// interpreter runs on a single core and the M0+ has no atomics anyway.
+//
+// Pools have a constexpr constructor and no destructor, so they are
+// usable during static initialization and are never torn down at exit.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <new>
+#include <utility>
+
+template<typename T, int SLAB_SIZE = 32>
+struct Pool {
+    union Node {
+        Node *next;
+        alignas(T) char data[sizeof(T)];
+    };
+    struct Slab {
+        Slab *next;
+        Node nodes[SLAB_SIZE];
+    };
+
+    Node *free_list = 0;
+    Slab *slabs = 0;
+
+    // Statistics
+    uint32_t allocs = 0;    // objects ever handed out
+    uint32_t live = 0;      // objects in use
+    uint32_t peak = 0;      // most objects ever in use
+    uint32_t nslabs = 0;
+
+    constexpr Pool() {}
+
+    void *alloc() {
+        if (!free_list) grow();
+        Node *n = free_list;
+        free_list = n->next;
+        allocs++;
+        if (++live > peak) peak = live;
+        return n;
+    }
+
+    void free(void *p) {
+        Node *n = (Node *)p;
+        n->next = free_list;
+        free_list = n;
+        live--;
+    }
+
+    void grow() {
+        Slab *s = new Slab;
+        s->next = slabs;
+        slabs = s;
+        nslabs++;
+        for (int i=SLAB_SIZE-1; i>=0; i--) {
+            s->nodes[i].next = free_list;
+            free_list = &s->nodes[i];
+        }
+    }
+
+    void print(const char *name) const {
+        printf("%-8s %3u bytes each, %6u live, %6u peak, %8u allocs, %4u slabs (%u bytes)\n",
+            name, (unsigned)sizeof(Node), (unsigned)live, (unsigned)peak, (unsigned)allocs,
+            (unsigned)nslabs, (unsigned)(nslabs * sizeof(Slab)));
+    }
+};
+
+struct RefCounted {
+    int refs = 0;
+
+    RefCounted() {}
+    // A copy is a new object with no references yet
+    RefCounted(const RefCounted&) {}
+    RefCounted& operator=(const RefCounted&) { return *this; }
+};
+
+template<typename T>
+inline void destroy_ref(T *p)
+{
+    p->~T();
+    T::pool.free(p);
+}
+
+// Intrusive counted pointer, with the parts of the shared_ptr interface
+// the interpreter uses
+template<typename T>
+class Ref {
+    T *p = 0;
+
+    static void drop(T *old) {
+        if (old && --old->refs == 0) destroy_ref(old);
+    }
+
+public:
+    Ref() {}
+    Ref(std::nullptr_t) {}
+    explicit Ref(T *t) : p(t) { if (p) p->refs++; }
+    Ref(const Ref& o) : p(o.p) { if (p) p->refs++; }
+    Ref(Ref&& o) : p(o.p) { o.p = 0; }
+    ~Ref() { drop(p); }
+
+    // The old object is only released once this points at the new one,
+    // since dropping it may free whatever held the new one
+    Ref& operator=(const Ref& o) {
+        T *old = p;
+        p = o.p;
+        if (p) p->refs++;
+        drop(old);
+        return *this;
+    }
+    Ref& operator=(Ref&& o) {
+        if (this == &o) return *this;
+        T *old = p;
+        p = o.p;
+        o.p = 0;
+        drop(old);
+        return *this;
+    }
+    Ref& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+    void reset() {
+        T *old = p;
+        p = 0;
+        drop(old);
+    }
+
+    T *get() const { return p; }
+    T *operator->() const { return p; }
+    T& operator*() const { return *p; }
+    explicit operator bool() const { return p != 0; }
+
+    bool operator==(const Ref& o) const { return p == o.p; }
+    bool operator!=(const Ref& o) const { return p != o.p; }
+    bool operator==(std::nullptr_t) const { return p == 0; }
+    bool operator!=(std::nullptr_t) const { return p != 0; }
+};
+
+template<typename T, typename... Args>
+inline Ref<T> make_ref(Args&&... args)
+{
+    void *m = T::pool.alloc();
+    return Ref<T>(new (m) T(std::forward<Args>(args)...));
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include "scheduler.hpp"
+#include "instrument.hpp"
+#include "pico/time.h"
+#include <algorithm>
+
+// One scanline of 800 pixels at 25MHz
+static constexpr uint32_t LINE_US = 32;
+
+void Scheduler::add_task(const char *name, task_f f, int priority, int when,
+        uint32_t period_us, uint32_t budget_us)
+{
+    Task t;
+    t.name = name;
+    t.func = f;
+    t.priority = priority;
+    t.when = when;
+    t.period_us = period_us;
+    t.budget_us = budget_us;
+    if (period_us) t.next_run = time_us_64() + period_us;
+
+    // Keep tasks sorted by priority, after any of equal priority
+    auto i = std::upper_bound(tasks.begin(), tasks.end(), t,
+        [](const Task& a, const Task& b) { return a.priority < b.priority; });
+    tasks.insert(i, t);
+}
+
+void Scheduler::remove_task(task_f f)
+{
+    tasks.erase(std::remove_if(tasks.begin(), tasks.end(),
+        [f](const Task& t) { return t.func == f; }), tasks.end());
+}
+
+uint32_t Scheduler::time_left(int when)
+{
+    int line = video->scanline;
+    switch (when) {
+    case VBLANK:
+        return VGAVideo::in_vblank(line) ? (VGAVideo::VTOTAL - line) * LINE_US : 0;
+    case VACTIVE:
+        return VGAVideo::in_vactive(line) ? (VGAVideo::VACTIVE - line) * LINE_US : 0;
+    default:
+        return 0xffffffff;
+    }
+}
+
+void Scheduler::run_once()
+{
+    uint64_t now = time_us_64();
+    if (last_pass) pass_time.add(now - last_pass);
+    last_pass = now;
+
+    for (size_t i=0; i<tasks.size(); i++) {
+        Task& t = tasks[i];
+        if (t.period_us && now < t.next_run) continue;
+
+        if (t.when != ANYTIME) {
+            uint32_t left = time_left(t.when);
+            if (!left) continue;
+            if (t.when == VBLANK && t.last_frame == video->frame) continue;
+            if (left < t.budget_us) {
+                INSTR_TRACE(EV_TASK_DEFER, left);
+                t.deferred++;
+                continue;
+            }
+            t.last_frame = video->frame;
+        }
+
+        uint64_t start = time_us_64();
+        t.func();
+        now = time_us_64();
+        uint32_t dt = now - start;
+        t.runtime.add(dt);
+        if (t.budget_us && dt > t.budget_us) {
+            INSTR_TRACE(EV_TASK_OVERRUN, dt);
+            t.overruns++;
+        }
+        if (t.period_us) t.next_run = start + t.period_us;
+    }
+}
+
+void Scheduler::report()
+{
+    pass_time.print("pass");
+    for (size_t i=0; i<tasks.size(); i++) {
+        Task& t = tasks[i];
+        t.runtime.print(t.name);
+        if (t.overruns || t.deferred) {
+            printf("%-10s overruns=%u deferred=%u\n", "", (unsigned)t.overruns, (unsigned)t.deferred);
+        }
+    }
+}
+
+void Scheduler::reset_stats()
+{
+    pass_time.reset();
+    for (size_t i=0; i<tasks.size(); i++) {
+        tasks[i].runtime.reset();
+        tasks[i].overruns = 0;
+        tasks[i].deferred = 0;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef INCLUDED_SCHEDULER_HPP
+#define INCLUDED_SCHEDULER_HPP
+
+#include "video.hpp"
+#include "histogram.hpp"
+#include <vector>
+
+typedef void (*task_f)();
+
+// Cooperative scheduler for the console core. Each pass runs, in priority
+// order, every task that is due. A task can be limited to part of the video
+// frame and won't be started unless its time budget fits in what's left of
+// that part, so long work doesn't spill out of vertical blank.
+struct Scheduler {
+    enum {
+        ANYTIME,        // whenever due
+        VBLANK,         // once per frame, inside vertical blank
+        VACTIVE         // only while the beam is drawing
+    };
+
+    struct Task {
+        const char *name;
+        task_f func;
+        int priority;           // lower runs first
+        int when;
+        uint32_t period_us;     // minimum time between starts, 0 for every pass
+        uint32_t budget_us;     // expected worst case run time
+        uint64_t next_run = 0;
+        uint32_t last_frame = 0xffffffff;
+        Histogram runtime;
+        uint32_t overruns = 0;  // runs longer than budget
+        uint32_t deferred = 0;  // times skipped because the budget didn't fit
+    };
+
+    VGAVideo *video;
+    std::vector<Task> tasks;
+    Histogram pass_time;
+    uint64_t last_pass = 0;
+
+    Scheduler(VGAVideo *v) : video(v) {}
+
+    void add_task(const char *name, task_f f, int priority, int when = ANYTIME,
+            uint32_t period_us = 0, uint32_t budget_us = 0);
+    void remove_task(task_f f);
+    void run_once();
+    void report();
+    void reset_stats();
+
+    // Microseconds left in the current part of the frame
+    uint32_t time_left(int when);
+};
+
+#endif
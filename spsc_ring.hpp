@@ -0,0 +1,117 @@
+#ifndef INCLUDED_SPSC_RING_HPP
+#define INCLUDED_SPSC_RING_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include "pico/time.h"
+
+// Lock-free ring buffer for exactly one producer and one consumer, which may
+// be on different cores. head and tail run freely and are masked on use, so
+// all N slots are usable. Each side only stores its own index, with release
+// ordering, after the data it covers; the other side loads it with acquire.
+// Plain word loads and stores are enough, so this is lock-free on the M0+.
+template<typename T, int N>
+struct SPSCRing {
+    static_assert((N & (N-1)) == 0, "SPSCRing size must be a power of 2");
+
+    static constexpr uint32_t FOREVER = 0xffffffff;
+
+    std::atomic<uint32_t> head{0};  // written by consumer
+    std::atomic<uint32_t> tail{0};  // written by producer
+    T buffer[N];
+
+    // Producer-side statistics
+    uint32_t high_water = 0;    // most items ever waiting
+    uint32_t overflows = 0;     // items dropped because the ring was full
+    uint32_t waits = 0;         // writes that had to wait for space
+
+    int size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+    int space() const { return N - size(); }
+
+    // Producer: get contiguous free space at the tail. Returns how many
+    // items may be stored at *p before calling commit().
+    int reserve(T **p) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        uint32_t h = head.load(std::memory_order_acquire);
+        uint32_t ix = t & (N-1);
+        int space = N - (t - h);
+        if (space > N - (int)ix) space = N - ix;
+        *p = buffer + ix;
+        return space;
+    }
+
+    // Producer: publish n items written into reserved space
+    void commit(int n) {
+        uint32_t t = tail.load(std::memory_order_relaxed) + n;
+        tail.store(t, std::memory_order_release);
+        uint32_t used = t - head.load(std::memory_order_relaxed);
+        if (used > high_water) high_water = used;
+    }
+
+    // Producer: copy in up to len items, waiting up to timeout_us for the
+    // consumer to make room. A timeout of 0 never waits and FOREVER never
+    // gives up. Items that don't fit are dropped and counted. Returns the
+    // number of items written.
+    int write(const T *p, int len, uint32_t timeout_us = 0) {
+        int done = 0;
+        bool waited = false;
+        uint32_t start = 0;
+        while (done < len) {
+            T *dst;
+            int n = reserve(&dst);
+            if (n == 0) {
+                if (timeout_us == 0) break;
+                if (!waited) {
+                    waited = true;
+                    waits++;
+                    start = time_us_32();
+                }
+                if (timeout_us != FOREVER && time_us_32() - start >= timeout_us) break;
+                continue;
+            }
+            if (n > len - done) n = len - done;
+            memcpy(dst, p + done, n * sizeof(T));
+            commit(n);
+            done += n;
+        }
+        overflows += len - done;
+        return done;
+    }
+
+    // Producer: single item, never waits
+    bool put(const T& v) {
+        return write(&v, 1) == 1;
+    }
+
+    // Consumer: get the contiguous run of items waiting at the head. Returns
+    // how many may be read at *p before calling consume().
+    int peek(T **p) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t t = tail.load(std::memory_order_acquire);
+        uint32_t ix = h & (N-1);
+        int count = t - h;
+        if (count > N - (int)ix) count = N - ix;
+        *p = buffer + ix;
+        return count;
+    }
+
+    // Consumer: release n items obtained from peek()
+    void consume(int n) {
+        head.store(head.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    // Consumer: single item
+    bool get(T& v) {
+        T *p;
+        if (!peek(&p)) return false;
+        v = *p;
+        consume(1);
+        return true;
+    }
+};
+
+#endif
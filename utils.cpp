@@ -7,24 +7,94 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <algorithm>
 
 #define ASSERT_X(x) (assert((x) >= 0 && (x) < width))
 #define ASSERT_Y(y) (assert((y) >= 0 && (y) < height))
 
 int GTerm::calc_color(int fg, int bg, int flags)
 {
-	return (flags & 0x0f) | (fg << 4) | (bg << 8);
+	return (flags & 0x0f) | (fg << 8) | (bg << 16);
 }
 
-void GTerm::update_changes()
+/*
+ * Hardware palette is RGBI: bit 0 red, bit 1 green, bit 2 blue, bit 3
+ * lighten.  Component levels are taken from colors.txt.
+ */
+static constexpr int hw_level(int c, int bit)
 {
-    int yp, start_x, mx, end_x;
-    int blank, c, x, y;
-    constexpr int no_blank = UNDERLINE | INVERSE;
+	return (c & 8) ? ((c & bit) ? 0xff : 0x66) : ((c & bit) ? 0x99 : 0);
+}
+
+// xterm 256-color palette: 16 ANSI, 6x6x6 cube, 24 step gray ramp
+static constexpr int cube_level[6] = {0, 95, 135, 175, 215, 255};
+
+static constexpr int xterm_level(int index, int bit)
+{
+	if (index < 16) return hw_level(index, bit);
+	if (index >= 232) return 8 + (index-232)*10;
+	index -= 16;
+	if (bit == 1) return cube_level[index / 36];
+	if (bit == 2) return cube_level[(index / 6) % 6];
+	return cube_level[index % 6];
+}
+
+static constexpr int sq(int x) { return x*x; }
+
+struct Palette16 {
+	unsigned char map[256];
+
+	constexpr Palette16() : map() {
+		for (int i=0; i<256; i++) {
+			int r = xterm_level(i, 1), g = xterm_level(i, 2), b = xterm_level(i, 4);
+			int best = 0, best_d = 0x7fffffff;
+			for (int c=0; c<16; c++) {
+				int d = sq(r-hw_level(c, 1)) + sq(g-hw_level(c, 2)) +
+					sq(b-hw_level(c, 4));
+				if (d < best_d) {
+					best_d = d;
+					best = c;
+				}
+			}
+			// the ANSI colors map to themselves
+			map[i] = (i < 16) ? i : best;
+		}
+	}
+};
+
+static constexpr Palette16 palette16_lut;
+const unsigned char *const GTerm::palette16 = palette16_lut.map;
+
+// Quantize a truecolor value to the nearest cube or gray ramp entry
+int GTerm::rgb_to_index(int r, int g, int b)
+{
+	auto cube = [](int v) { return v < 48 ? 0 : v < 115 ? 1 : (v-35)/40; };
+	int ri = cube(r), gi = cube(g), bi = cube(b);
+	int cube_d = sq(r-cube_level[ri]) + sq(g-cube_level[gi]) + sq(b-cube_level[bi]);
+
+	int avg = (r+g+b)/3;
+	int gray = avg > 238 ? 23 : avg < 8 ? 0 : (avg-3)/10;
+	int lv = 8 + gray*10;
+	int gray_d = sq(r-lv) + sq(g-lv) + sq(b-lv);
+
+	if (gray_d < cube_d) return 232 + gray;
+	return 16 + ri*36 + gi*6 + bi;
+}
+
+int GTerm::update_changes(bool partial)
+{
+    int yp, mx, x, y;
+    int deferred = 0;
+    unsigned int c;
     
     // prevent recursion for scrolls which cause exposures
-    if (doing_update) return;
-    doing_update = true;
+    if (doing_update) return 0;
+    // the application is mid-frame; everything stays dirty until it's done
+    if (sync_update) return 0;
+    // or the child isn't taking updates at the moment
+    if (!CanUpdate()) return 0;
+
+    flush_scroll();
 
     // first perform scroll-copy
     // TODO: understand pending scroll
@@ -32,6 +102,16 @@ void GTerm::update_changes()
     if (!(mode_flags & TEXTONLY) && pending_scroll && 
             pending_scroll<mx && -pending_scroll<mx) {
 
+        // The rows below depend on the copy, so if the copy can't be done
+        // yet nothing can
+        if (partial && !CanDrawRows(scroll_top, scroll_bot)) {
+            for (y=0; y<height; y++) {
+                if (dirty_startx[y]<width) deferred++;
+            }
+            return deferred;
+        }
+
+        doing_update = true;
         if (pending_scroll<0) {
             //scroll down
             MoveChars(0, scroll_top, 0, scroll_top-pending_scroll,
@@ -42,63 +122,82 @@ void GTerm::update_changes()
         }
     }
     pending_scroll = 0;
+    doing_update = true;
 
     // then update characters
     for (y=0; y<height; y++) {
         if (dirty_startx[y]>=width) continue;
+        if (partial && !CanDrawRows(y, y)) {
+            deferred++;
+            continue;
+        }
         yp = linenumbers[y]*width;
+        scroll_stats.lines_rendered++;
 
-        blank = !(mode_flags & TEXTONLY);
-        start_x = dirty_startx[y];
-        end_x = dirty_endx[y];
-        // printf("Line %d dirty from %d to %d\n", y, start_x, end_x);
-        c = color[yp+start_x];
-        //TODO:optimize
-        //use blank to fast clearing
-        for (x=start_x; x<=end_x; x++) {
-            if ((text[yp+x]!=32 && text[yp+x]) || (no_blank & FLAG(c))!=0) blank = 0;
-            if (c != color[yp+x]) {
-                if (!blank) {
-                    if (inverse_mode)
-                        DrawText(0,7, FLAG(c), start_x,
-                                y, x-start_x, text+yp+start_x);
-                    else
-                        DrawText(FGCOLOR(c),BGCOLOR(c), FLAG(c), start_x,
-                                y, x-start_x, text+yp+start_x);
-                } else {
-                    ClearChars(inverse_mode?7:BGCOLOR(c), start_x, y, x-start_x, 1);
-                }
-                start_x = x;
-                c = color[yp+x];
-                blank = !(mode_flags & TEXTONLY);
-                if ((text[yp+x]!=32 && text[yp+x]) || (no_blank & FLAG(c))!=0) blank = 0;
-            }
-        }
-        if (!blank) {
-            if (inverse_mode)
-                DrawText(0,7, FLAG(c), start_x,
-                        y, x-start_x, text+yp+start_x);
-            else
-                DrawText(FGCOLOR(c),BGCOLOR(c), FLAG(c), start_x,
-                        y, x-start_x, text+yp+start_x);
-        } else {
-            ClearChars(inverse_mode?7:BGCOLOR(c), start_x, y, x-start_x, 1);
-        }
+        DrawSpan(y, dirty_startx[y], dirty_endx[y], text+yp, color+yp,
+                inverse_mode, mode_flags & TEXTONLY);
 
         dirty_endx[y] = 0;
         dirty_startx[y] = width;
     }
 
-    if (!(mode_flags & CURSORINVISIBLE)) {
+    if (!(mode_flags & CURSORINVISIBLE) &&
+            (!partial || CanDrawRows(cursor_y, cursor_y))) {
         x = cursor_x;
         ASSERT_X(x);
         //if (x>=width) x = width-1;
         yp = linenumbers[cursor_y] * width + x;
         c = color[yp];
-        DrawCursor(FGCOLOR(c),BGCOLOR(c), FLAG(c), x, cursor_y, text[yp]);
+        DrawCursor(palette16[FGCOLOR(c)],palette16[BGCOLOR(c)], FLAG(c), x, cursor_y, text[yp]);
     }
 
     doing_update = false;
+    return deferred;
+}
+
+// Draw cells start_x..end_x of screen row y, one DrawText per run of the
+// same color, or ClearChars for a run that is all blank.  text and color
+// point at the start of the row, which needn't be in the cell buffer.
+void GTerm::draw_span(int y, int start_x, int end_x, unsigned char *text,
+        unsigned int *color, bool inverse, bool textonly)
+{
+    int blank, x;
+    unsigned int c;
+    constexpr int no_blank = UNDERLINE | INVERSE;
+
+    blank = !textonly;
+    c = color[start_x];
+    //TODO:optimize
+    //use blank to fast clearing
+    for (x=start_x; x<=end_x; x++) {
+        if ((text[x]!=32 && text[x]) || (no_blank & FLAG(c))!=0) blank = 0;
+        if (c != color[x]) {
+            if (!blank) {
+                if (inverse)
+                    DrawText(0,7, FLAG(c), start_x,
+                            y, x-start_x, text+start_x);
+                else
+                    DrawText(palette16[FGCOLOR(c)],palette16[BGCOLOR(c)], FLAG(c), start_x,
+                            y, x-start_x, text+start_x);
+            } else {
+                ClearChars(inverse?7:palette16[BGCOLOR(c)], start_x, y, x-start_x, 1);
+            }
+            start_x = x;
+            c = color[x];
+            blank = !textonly;
+            if ((text[x]!=32 && text[x]) || (no_blank & FLAG(c))!=0) blank = 0;
+        }
+    }
+    if (!blank) {
+        if (inverse)
+            DrawText(0,7, FLAG(c), start_x,
+                    y, x-start_x, text+start_x);
+        else
+            DrawText(palette16[FGCOLOR(c)],palette16[BGCOLOR(c)], FLAG(c), start_x,
+                    y, x-start_x, text+start_x);
+    } else {
+        ClearChars(inverse?7:palette16[BGCOLOR(c)], start_x, y, x-start_x, 1);
+    }
 }
 
 /**
@@ -123,10 +222,6 @@ void GTerm::scroll_region(int start_y, int end_y, int num)
     }
 
     int y, takey, fast_scroll, mx, clr, x, yp, c;
-    //TODO:optimize
-    short *temp = new short[height];
-    unsigned char *temp_sx = new unsigned char[height];
-    unsigned char *temp_ex = new unsigned char[height];
 
     //if (!num) return;
     mx = end_y-start_y+1;
@@ -136,7 +231,40 @@ void GTerm::scroll_region(int start_y, int end_y, int num)
     fast_scroll = (start_y == scroll_top && end_y == scroll_bot && 
             !(mode_flags & TEXTONLY));
 
-    if (fast_scroll) pending_scroll += num;
+    if (fast_scroll) {
+        pending_scroll += num;
+        scroll_stats.lines_scrolled += num < 0 ? -num : num;
+    }
+
+    if (fast_scroll && num > 0 && num < mx) {
+        // Scrolling up the whole region, as for a flood of newlines, only
+        // advances scroll_rot; flush_scroll renumbers the lines once
+        // before anything needs the real order.
+        for (y=start_y; y<start_y+num; y++) {
+            if (dirty_startx[row(y)] < width) scroll_stats.lines_dropped++;
+        }
+        scroll_rot += num;
+        if (scroll_rot >= mx) scroll_rot -= mx;
+
+        c = calc_color(fg_color, bg_color, mode_flags);
+        for (y=end_y-num+1; y<=end_y; y++) {
+            takey = row(y);
+            dirty_startx[takey] = 0;
+            dirty_endx[takey] = width-1;
+            yp = linenumbers[takey]*width;
+            memset(text+yp, ' ', width);
+            for (x=0; x<width; x++) {
+                color[yp++] = c;
+            }
+        }
+        return;
+    }
+    flush_scroll();
+
+    //TODO:optimize
+    short *temp = new short[height];
+    unsigned char *temp_sx = new unsigned char[height];
+    unsigned char *temp_ex = new unsigned char[height];
 
     memcpy(temp, linenumbers, height * sizeof(linenumbers[0]));
     if (fast_scroll) {
@@ -177,6 +305,50 @@ void GTerm::scroll_region(int start_y, int end_y, int num)
     delete[] temp_ex;
 }
 
+// Apply the rotation deferred by scroll_region to linenumbers and the
+// dirty spans that travel with each line
+void GTerm::flush_scroll()
+{
+    if (!scroll_rot) return;
+
+    std::rotate(linenumbers+scroll_top, linenumbers+scroll_top+scroll_rot,
+            linenumbers+scroll_bot+1);
+    std::rotate(dirty_startx+scroll_top, dirty_startx+scroll_top+scroll_rot,
+            dirty_startx+scroll_bot+1);
+    std::rotate(dirty_endx+scroll_top, dirty_endx+scroll_top+scroll_rot,
+            dirty_endx+scroll_bot+1);
+    scroll_rot = 0;
+    scroll_stats.renumbers++;
+}
+
+// Swap in the other screen buffer.  Only the buffer pointers change; every
+// line is then marked dirty so the new contents get drawn.
+void GTerm::switch_screen(bool alt)
+{
+    if (alt == alt_screen) return;
+
+    flush_scroll();
+    std::swap(text, alt_text);
+    std::swap(color, alt_color);
+    std::swap(linenumbers, alt_linenumbers);
+    alt_screen = alt;
+
+    // nothing on screen is worth blitting any more
+    pending_scroll = 0;
+    for (int y=0; y<height; y++) changed_line(y, 0, width-1);
+}
+
+// Blank the inactive screen buffer
+void GTerm::clear_alt_screen()
+{
+    int i, c;
+
+    c = calc_color(fg_color, bg_color, mode_flags);
+    memset(alt_text, ' ', width * height);
+    for (i=0; i<width*height; i++) alt_color[i] = c;
+    for (i=0; i<height; i++) alt_linenumbers[i] = i;
+}
+
 /**
  * shift text in [(start_x,y),(end_x,y)]
  * num > 0:shift right
@@ -193,7 +365,7 @@ void GTerm::shift_text(int y, int start_x, int end_x, int num)
 
     //     if (!num) return;
 
-    yp = linenumbers[y]*width;
+    yp = linenumbers[row(y)]*width;
 
     mx = end_x-start_x+1;
     if (num>mx) num = mx;
@@ -239,7 +411,7 @@ void GTerm::clear_area(int start_x, int start_y, int end_x, int end_y)
     //if (w<1) return;
 
     for (y=start_y; y<=end_y; y++) {
-        yp = linenumbers[y]*width;
+        yp = linenumbers[row(y)]*width;
         memset(text+yp+start_x, ' ', w);
         for (x=start_x; x<=end_x; x++) {
             color[yp+x] = c;
@@ -254,6 +426,7 @@ void GTerm::changed_line(int y, int start_x, int end_x)
     ASSERT_X(end_x);
     ASSERT_Y(y);
 
+	y = row(y);
 	if (dirty_startx[y] > start_x) dirty_startx[y] = start_x;
 	if (dirty_endx[y] < end_x) dirty_endx[y] = end_x;
 }
@@ -9,45 +9,128 @@ VGATerm::~VGATerm() {}
 void VGATerm::DrawText(int fg_color, int bg_color, int flags,
                 int x, int y, int len, unsigned char *string)
 {
-    y += row_offset;
+    y += draw_offset;
 	if (flags & INVERSE) {
 		int t = fg_color;
 		fg_color = bg_color;
 		bg_color = t;
 	}
 
-    uint8_t colors = (bg_color << 4) | (fg_color & 7) | ((!!flags & BOLD) << 3);
+    // Colors arrive as 4-bit hardware indices; bold selects the light half
+    uint8_t fg = (fg_color | ((flags & BOLD) << 3)) & 15;
+    uint8_t colors = ((bg_color & 15) << 4) | fg;
     graphics->draw_string(x, y, colors, string, len);
 
 	if (flags&UNDERLINE) {
-        uint8_t colors = (fg_color & 7) | ((!!flags & BOLD) << 3);
+        uint8_t colors = fg;
         graphics->draw_line(x, y, colors, len);
     }
 }
 
 void VGATerm::DrawCursor(int fg_color, int bg_color, int flags,
                 int x, int y, unsigned char c)
+{
+    if (!queue) {
+        draw_cursor(fg_color, bg_color, flags, x, y, c);
+        return;
+    }
+    DrawCmd *cmd = queue_cmd(DrawCmd::CURSOR, y, y);
+    cmd->fg = fg_color;
+    cmd->bg = bg_color;
+    cmd->flags = flags;
+    cmd->x = x;
+    cmd->y = y;
+    cmd->text[0] = c;
+    queue->commit(1);
+}
+
+void VGATerm::draw_cursor(int fg_color, int bg_color, int flags,
+                int x, int y, unsigned char c)
 {
 	unsigned char str[2] = {c, 0};
-	DrawText(7-fg_color, 7-bg_color, flags, x, y, 1, str);
+	DrawText(fg_color^7, bg_color^7, flags, x, y, 1, str);
+}
+
+void VGATerm::DrawSpan(int y, int start_x, int end_x, unsigned char *text,
+                unsigned int *color, bool inverse, bool textonly)
+{
+    if (!queue) {
+        draw_span(y, start_x, end_x, text, color, inverse, textonly);
+        return;
+    }
+    int w = end_x - start_x + 1;
+    DrawCmd *cmd = queue_cmd(DrawCmd::SPAN, y, y);
+    cmd->inverse = inverse;
+    cmd->textonly = textonly;
+    cmd->x = start_x;
+    cmd->y = y;
+    cmd->w = w;
+    memcpy(cmd->text + start_x, text + start_x, w);
+    memcpy(cmd->color + start_x, color + start_x, w * sizeof(*color));
+    queue->commit(1);
+    cells_queued += w;
 }
 
 void VGATerm::MoveChars(int sx, int sy, int dx, int dy, int w, int h)
 {
-    sy += row_offset;
-    dy += row_offset;
+    if (!queue) {
+        move_chars(sx, sy, dx, dy, w, h);
+        return;
+    }
+    DrawCmd *cmd = queue_cmd(DrawCmd::MOVE, sy < dy ? sy : dy,
+        (sy > dy ? sy : dy) + h - 1);
+    cmd->sx = sx;
+    cmd->sy = sy;
+    cmd->x = dx;
+    cmd->y = dy;
+    cmd->w = w;
+    cmd->h = h;
+    queue->commit(1);
+}
+
+void VGATerm::move_chars(int sx, int sy, int dx, int dy, int w, int h)
+{
+    sy += draw_offset;
+    dy += draw_offset;
     graphics->copy_area(sx, sy, dx, dy, w, h);
 }
 
 void VGATerm::ClearChars(int bg_color, int x, int y, int w, int h)
 {
-    y += row_offset;
+    y += draw_offset;
     graphics->clear_area(x, y, bg_color, w);
 }
 
+// Rows can be drawn without tearing unless the beam is on them or about to
+// reach them. BEAM_MARGIN scanlines (0.5ms) covers drawing a row. A scroll
+// copy spans many rows, but it moves lines top down far faster than the
+// beam, so the same head start is enough.
+static constexpr int BEAM_MARGIN = 16;
+
+bool VGATerm::CanDrawRows(int top, int bottom)
+{
+    return beam_clear(top + draw_offset, bottom + draw_offset);
+}
+
+// Rows on the screen, rather than in the terminal
+bool VGATerm::beam_clear(int top, int bottom)
+{
+    int line = graphics->video->scanline;
+    int first = top * VGAGraphics::FONT_HEIGHT;
+    int last = (bottom + 1) * VGAGraphics::FONT_HEIGHT - 1;
+
+    // Lines in vertical blank come just before line 0 of the next frame
+    if (VGAVideo::in_vblank(line)) line -= VGAVideo::VTOTAL;
+    return line > last || line + BEAM_MARGIN < first;
+}
+
 void VGATerm::SendBack(const char *data)
 {
-	write(1, data, strlen(data));
+	if (hold_replies) {
+		replies += data;
+	} else {
+		write(1, data, strlen(data));
+	}
 }
 
 void VGATerm::Bell()
@@ -55,15 +138,101 @@ void VGATerm::Bell()
 	//XBell(display, 0);
 }
 
+// Sizes larger than the screen, like the 132 columns of DECCOLM, get as
+// much as fits
 void VGATerm::RequestSizeChange(int w, int h)
 {
-    // if (w != Width() || h != Height()) {
-    //     ResizeTerminal(w, h);
-    // }
+    if (w > VGAGraphics::COLUMNS) w = VGAGraphics::COLUMNS;
+    if (h > VGAGraphics::ROWS) h = VGAGraphics::ROWS;
+    if (w != Width() || h != Height()) {
+        ResizeTerminal(w, h);
+    }
+}
+
+void VGATerm::ResizeTerminal(int w, int h)
+{
+    GTerm::ResizeTerminal(w, h);
+    row_offset = (VGAGraphics::ROWS - Height()) / 2;
+    geometry++;
+    
+    // Queued drawing catches up when it reaches the first command queued
+    // with the new geometry
+    if (!queue) {
+        clear_screen();
+        draw_offset = row_offset;
+        drawn_geometry = geometry;
+    }
+}
+
+void VGATerm::clear_screen()
+{
+    for (int y=0; y<VGAGraphics::ROWS; y++) {
+        graphics->clear_area(0, y, 0, VGAGraphics::COLUMNS);
+    }
 }
 
 void VGATerm::PlotPixel(int x, int y, int c)
+{
+    if (!queue) {
+        plot_pixel(x, y, c);
+        return;
+    }
+    // Pixels come straight from the parser rather than from an update,
+    // so there's no room set aside for them; drop them if the queue is full
+    if (!queue->space()) {
+        queue->overflows++;
+        return;
+    }
+    int row = y / VGAGraphics::FONT_HEIGHT - row_offset;
+    DrawCmd *cmd = queue_cmd(DrawCmd::PIXEL, row, row);
+    cmd->x = x;
+    cmd->y = y;
+    cmd->fg = c;
+    queue->commit(1);
+}
+
+void VGATerm::plot_pixel(int x, int y, int c)
 {
     //if (x < 0 || y < 0 || x >= 640 || y >= 480) return;
     graphics->plot_pixel(x, y, c);
 }
+
+// The next free command in the queue. Callers make sure there is one: an
+// update only starts once there's room for all it can queue.
+DrawCmd *VGATerm::queue_cmd(int op, int top, int bottom)
+{
+    DrawCmd *cmd;
+    queue->reserve(&cmd);
+    cmd->op = op;
+    cmd->geometry = geometry;
+    cmd->row_offset = row_offset;
+    cmd->top = top;
+    cmd->bottom = bottom;
+    return cmd;
+}
+
+void VGATerm::execute(const DrawCmd& cmd)
+{
+    if (cmd.geometry != drawn_geometry) {
+        clear_screen();
+        drawn_geometry = cmd.geometry;
+    }
+    draw_offset = cmd.row_offset;
+    
+    switch (cmd.op) {
+    case DrawCmd::SPAN:
+        draw_span(cmd.y, cmd.x, cmd.x + cmd.w - 1, (unsigned char *)cmd.text,
+            (unsigned int *)cmd.color, cmd.inverse, cmd.textonly);
+        cells_drawn += cmd.w;
+        break;
+    case DrawCmd::MOVE:
+        move_chars(cmd.sx, cmd.sy, cmd.x, cmd.y, cmd.w, cmd.h);
+        break;
+    case DrawCmd::CURSOR:
+        draw_cursor(cmd.fg, cmd.bg, cmd.flags, cmd.x, cmd.y, cmd.text[0]);
+        break;
+    case DrawCmd::PIXEL:
+        plot_pixel(cmd.x, cmd.y, cmd.fg);
+        break;
+    }
+}
@@ -3,12 +3,60 @@
 
 #include "gterm.hpp"
 #include "graphics.hpp"
+#include "spsc_ring.hpp"
+#include <string>
+
+// One drawing operation from an update, carrying a copy of the cells it
+// draws, so it can be carried out on another core while the emulator goes
+// on changing its own cells.
+struct DrawCmd {
+    enum { SPAN, MOVE, CURSOR, PIXEL };
+    static constexpr int COLS = VGAGraphics::COLUMNS;
+    
+    uint8_t op;
+    uint8_t inverse, textonly;  // SPAN: the terminal's modes at the time
+    uint8_t geometry;           // the terminal's size when queued
+    short row_offset;
+    short top, bottom;          // text rows touched, for racing the beam
+    short x, y, w, h;           // SPAN: cells x..x+w-1 of row y
+    short sx, sy;               // MOVE: source, to x,y
+    int fg, bg, flags;          // CURSOR, and fg for PIXEL
+    unsigned char text[COLS];   // SPAN, indexed by column
+    unsigned int color[COLS];
+};
+
+// Enough for the largest update: a scroll, every row and the cursor
+typedef SPSCRing<DrawCmd, 32> DrawQueue;
+static_assert(VGAGraphics::ROWS + 2 <= 32, "DrawQueue can't hold a full update");
 
 struct VGATerm : public GTerm {
     VGAGraphics *graphics;
-    int row_offset = 3;
     
-    VGATerm(VGAGraphics *g) : GTerm(80, 24) { 
+    // The terminal fills the screen, or is centered on it when resized to
+    // something smaller. geometry counts size changes; the drawing side
+    // clears the screen when it sees a new one. Drawing uses draw_offset,
+    // which follows row_offset as the drawing catches up.
+    int row_offset = 0;
+    uint8_t geometry = 0;
+    int draw_offset = 0;
+    uint8_t drawn_geometry = 0;
+    
+    // With a queue, updates only queue commands, and the drawing is done
+    // by whoever calls execute(); without one, VGATerm draws directly.
+    // Updates are only taken while queue_open is set, by the owner of the
+    // queue once it has made sure there's room for one.
+    DrawQueue *queue = 0;
+    bool queue_open = false;
+    volatile uint32_t cells_queued = 0;     // written by the queueing side
+    volatile uint32_t cells_drawn = 0;      // written by the drawing side
+    
+    // With hold_replies set, answers to queries like DA and DSR collect in
+    // replies for the owner to send once it has let go of the emulator;
+    // otherwise SendBack writes them straight to stdout.
+    bool hold_replies = false;
+    std::string replies;
+    
+    VGATerm(VGAGraphics *g) : GTerm(VGAGraphics::COLUMNS, VGAGraphics::ROWS) { 
         graphics = g;
         //set_mode_flag(TEXTONLY);
         set_mode_flag(DEFERUPDATE);
@@ -20,14 +68,34 @@ struct VGATerm : public GTerm {
             int x, int y, int len, unsigned char *string);
     void DrawCursor(int fg_color, int bg_color, int flags,
             int x, int y, unsigned char c);
+    void DrawSpan(int y, int start_x, int end_x, unsigned char *text,
+            unsigned int *color, bool inverse, bool textonly);
 
     void MoveChars(int sx, int sy, int dx, int dy, int w, int h);
     void ClearChars(int bg_color, int x, int y, int w, int h);
 	void SendBack(const char *data);
 	void Bell();
 	void RequestSizeChange(int w, int h);
+    void ResizeTerminal(int w, int h);
     void PlotPixel(int x, int y, int c);
+    bool CanUpdate() { return !queue || queue_open; }
+    bool CanDrawRows(int top, int bottom);
+    
+    // Draw a queued command, and check whether that can be done now
+    void execute(const DrawCmd& cmd);
+    bool can_execute(const DrawCmd& cmd) {
+        return beam_clear(cmd.top + cmd.row_offset, cmd.bottom + cmd.row_offset);
+    }
+    
+private:
+    bool beam_clear(int top, int bottom);
+    void clear_screen();
+    DrawCmd *queue_cmd(int op, int top, int bottom);
+    void draw_cursor(int fg_color, int bg_color, int flags,
+            int x, int y, unsigned char c);
+    void move_chars(int sx, int sy, int dx, int dy, int w, int h);
+    void plot_pixel(int x, int y, int c);
 };
 
 
-#endif
\ No newline at end of file
+#endif
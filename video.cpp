@@ -39,7 +39,11 @@ void __not_in_flash_func(VGAVideo::hblank_isr)()
 
     // Increment scanline
     scanline++;
-    if (scanline == VTOTAL) scanline = 0;    
+    if (scanline == VTOTAL) {
+        scanline = 0;
+        frame++;
+        if (doorbell) doorbell->ring();
+    }
     
     // This kind of ISR requires explicit reset of the IRQ
     pio_interrupt_clear(pio0, 0);
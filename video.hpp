@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include "doorbell.hpp"
 
 typedef void (*hsr_f)();
 
@@ -29,6 +30,8 @@ struct VGAVideo {
     static constexpr int L_PIN = 5;    // Lighten
     
     volatile int scanline = 0;
+    volatile uint32_t frame = 0;    // counts up at the top of every frame
+    Doorbell *doorbell = 0;         // rung at the top of every frame
     hsr_f isr_ptr;
     void hblank_isr();
     